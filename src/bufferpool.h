@@ -0,0 +1,81 @@
+#ifndef H_BUFFERPOOL
+#define H_BUFFERPOOL
+
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+/*  Class BufferPool: A global free list of packet buffers.
+ *
+ *  PacketCrafter builds its packets in buffers taken from here, hands them on
+ *  to the egress queue by moving, and the connection puts them back here once
+ *  they have been written out. In the steady state, small packets thus never
+ *  touch the heap. Big buffers (map chunk data and the like) are not kept.
+ */
+
+class BufferPool
+{
+public:
+  enum { defaultCapacity = 256, maxCapacity = 4096, maxBuffers = 4096 };
+
+  /// An empty buffer with room for at least `capacity` bytes.
+
+  static inline std::string acquire(size_t capacity = defaultCapacity)
+  {
+    std::string s;
+
+    {
+      Pool & p = pool();
+      std::lock_guard<std::mutex> lock(p.mutex);
+      if (!p.free.empty())
+      {
+        s.swap(p.free.back());
+        p.free.pop_back();
+      }
+    }
+
+    if (s.capacity() < capacity) s.reserve(capacity);
+    return s;
+  }
+
+  /// A pooled copy of some data.
+
+  static inline std::string copy(const char * data, size_t len)
+  {
+    std::string s = acquire(len);
+    s.assign(data, len);
+    return s;
+  }
+
+  /// Give a buffer back. Buffers that are too small to be worth it, or too big to keep, are freed.
+
+  static inline void release(std::string && s)
+  {
+    if (s.capacity() < defaultCapacity || s.capacity() > maxCapacity) return;
+
+    s.clear();
+
+    Pool & p = pool();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    if (p.free.size() < maxBuffers)
+    {
+      p.free.push_back(std::string());
+      p.free.back().swap(s);
+    }
+  }
+
+private:
+  struct Pool
+  {
+    Pool() : mutex(), free() { free.reserve(maxBuffers); }
+
+    std::mutex mutex;
+    std::vector<std::string> free;
+  };
+
+  static inline Pool & pool() { static Pool p; return p; }
+};
+
+
+#endif
@@ -1,13 +1,14 @@
 #include <iostream>
-#include <mutex>
+#include <algorithm>
 #include <zlib.h>
 
 #include "constants.h"
 #include "map.h"
 #include "chunk.h"
 
-static std::array<unsigned char, 100000> zlib_buffer;
-static std::mutex zlib_buffer_mutex;
+/// Scratch space for compress(), one per thread, so that chunks can be compressed in parallel.
+static thread_local std::array<unsigned char, 100000> zlib_buffer;
+static thread_local Chunk::ChunkData                  export_buffer;
 
 
 /*  The amount of light from the sky depending on the daytime, tick = 0 .. 23999.
@@ -33,88 +34,349 @@ int skySourceLight(unsigned long long ticks)
 Chunk::Chunk(const ChunkCoords & cc)
   :
   m_coords(cc),
-  m_data(),
+  m_sections(),
+  m_cold(),
+  m_histogram(),
+  m_solid(),
+  m_top(-1),
+  m_top_valid(true),
   m_heightmap(),
-  m_zcache(m_coords)
+  m_lit(false),
+  m_deflated()
 {
+  m_histogram[BLOCK_Air] = sizeBlockType;
 }
 
-/// This version uses global memory to hold the deflated data and returns a copy.
-std::string Chunk::compress() const
+bool Chunk::Section::empty() const
 {
-  /// Our chunks are always 80KiB, so we assume that 100KB suffice for the output and skip the bound check.
-  //unsigned long int outlength = compressBound(size());
-  //unsigned char * buf = new unsigned char[outlength];
-  //...
-  //delete[] buf;
+  for (size_t i = 0; i < block_type.size(); ++i)  if (block_type[i] != 0)     return false;
+  for (size_t i = 0; i < block_meta.size(); ++i)  if (block_meta[i] != 0)     return false;
+  for (size_t i = 0; i < block_light.size(); ++i) if (block_light[i] != 0)    return false;
+  for (size_t i = 0; i < sky_light.size(); ++i)   if (sky_light[i] != 0xFF)   return false;
+  return true;
+}
 
-  std::string result;
+size_t Chunk::sectionsInUse() const
+{
+  size_t n = 0;
+  for (size_t s = 0; s < sectionCount; ++s)
+    if (m_sections[s]) ++n;
+  return n;
+}
+
+size_t Chunk::residentSize() const
+{
+  if (m_cold)
+  {
+    return sizeof(Chunk) + sizeof(ColdData) + m_cold->palette.capacity()
+      + m_cold->indices.capacity() * sizeof(uint64_t) + m_cold->runs.capacity();
+  }
+
+  return sizeof(Chunk) + sectionsInUse() * sizeof(Section);
+}
+
+void Chunk::recountSummaries()
+{
+  m_histogram.fill(0);
+  m_solid.fill(0);
+
+  for (size_t s = 0; s < sectionCount; ++s)
+  {
+    const Section * sec = m_sections[s].get();
+
+    if (!sec)
+    {
+      m_histogram[BLOCK_Air] += sectionVolume;
+      continue;
+    }
+
+    for (size_t i = 0; i < sec->block_type.size(); ++i)
+      ++m_histogram[sec->block_type[i]];
+
+    m_solid[s] = sectionVolume - std::count(sec->block_type.begin(), sec->block_type.end(), BLOCK_Air);
+  }
+
+  m_top_valid = false;
+}
+
+int Chunk::topNonAirY() const
+{
+  if (m_top_valid) return m_top;
+
+  m_top = -1;
+
+  for (int s = sectionCount - 1; s >= 0 && m_top == -1; --s)
+  {
+    if (m_solid[s] == 0) continue;
+
+    for (int y = s * sectionHeight + sectionHeight - 1; y >= s * sectionHeight && m_top == -1; --y)
+      for (size_t x = 0; x < 16; ++x)
+        for (size_t z = 0; z < 16; ++z)
+          if (blockType(x, y, z) != BLOCK_Air) m_top = y;
+  }
+
+  m_top_valid = true;
+  return m_top;
+}
 
-  if (zlib_buffer_mutex.try_lock())
+bool Chunk::hasLightEmitters() const
+{
+  for (size_t b = 0; b < m_histogram.size(); ++b)
+    if (m_histogram[b] > 0 && emitLight(b) > 0) return true;
+  return false;
+}
+
+bool Chunk::hasStorageBlocks() const
+{
+  for (size_t b = 0; b < m_histogram.size(); ++b)
+    if (m_histogram[b] > 0 && isStorage(b)) return true;
+  return false;
+}
+
+void Chunk::compactSections()
+{
+  for (size_t s = 0; s < sectionCount; ++s)
+    if (m_sections[s] && m_sections[s]->empty())
+      m_sections[s].reset();
+}
+
+/// Each (x, z)-column of a section is a contiguous run of 16 bytes (8 for the nibble arrays),
+/// and so is the corresponding piece of the client layout, so we can copy column by column.
+
+void Chunk::exportData(ChunkData & data) const
+{
+  if (m_cold)
+  {
+    m_cold->decode(data);
+    return;
+  }
+
+  for (size_t x = 0; x < 16; ++x)
   {
-    try
+    for (size_t z = 0; z < 16; ++z)
     {
-      unsigned long int outlength = zlib_buffer.size();
-      int zres = ::compress(zlib_buffer.data(), &outlength, m_data.data(), size());
-      if (zres != Z_OK)
+      for (size_t s = 0; s < sectionCount; ++s)
       {
-        std::cerr << "Error during zlib deflate!" << std::endl;
+        const size_t i = index(x, s * sectionHeight, z);
+        const size_t j = sectionIndex(x, 0, z);
+        const Section * sec = m_sections[s].get();
+
+        if (sec)
+        {
+          std::copy(sec->block_type.begin()  + j,     sec->block_type.begin()  + j + 16,     data.begin() + offsetBlockType + i);
+          std::copy(sec->block_meta.begin()  + j / 2, sec->block_meta.begin()  + j / 2 + 8, data.begin() + offsetBlockMetaData + i / 2);
+          std::copy(sec->block_light.begin() + j / 2, sec->block_light.begin() + j / 2 + 8, data.begin() + offsetBlockLight + i / 2);
+          std::copy(sec->sky_light.begin()   + j / 2, sec->sky_light.begin()   + j / 2 + 8, data.begin() + offsetSkyLight + i / 2);
+        }
+        else
+        {
+          std::fill(data.begin() + offsetBlockType + i,         data.begin() + offsetBlockType + i + 16,        0);
+          std::fill(data.begin() + offsetBlockMetaData + i / 2, data.begin() + offsetBlockMetaData + i / 2 + 8, 0);
+          std::fill(data.begin() + offsetBlockLight + i / 2,    data.begin() + offsetBlockLight + i / 2 + 8,    0);
+          std::fill(data.begin() + offsetSkyLight + i / 2,      data.begin() + offsetSkyLight + i / 2 + 8,      0xFF);
+        }
       }
-      else
+    }
+  }
+}
+
+void Chunk::importData(const unsigned char * data, size_t len)
+{
+  const bool have_meta  = len >= size_t(offsetBlockMetaData + sizeBlockMetaData);
+  const bool have_light = len >= size_t(offsetSkyLight + sizeSkyLight);
+
+  for (size_t s = 0; s < sectionCount; ++s)
+  {
+    std::shared_ptr<Section> sec = std::make_shared<Section>();
+
+    for (size_t x = 0; x < 16; ++x)
+    {
+      for (size_t z = 0; z < 16; ++z)
       {
-        //std::cout << "zlib deflate: " << std::dec << outlength << std::endl;
-        result = std::string(reinterpret_cast<char*>(zlib_buffer.data()), outlength);
+        const size_t i = index(x, s * sectionHeight, z);
+        const size_t j = sectionIndex(x, 0, z);
+
+        std::copy(data + offsetBlockType + i, data + offsetBlockType + i + 16, sec->block_type.begin() + j);
+
+        if (have_meta)
+          std::copy(data + offsetBlockMetaData + i / 2, data + offsetBlockMetaData + i / 2 + 8, sec->block_meta.begin() + j / 2);
+
+        if (have_light)
+        {
+          std::copy(data + offsetBlockLight + i / 2, data + offsetBlockLight + i / 2 + 8, sec->block_light.begin() + j / 2);
+          std::copy(data + offsetSkyLight + i / 2,   data + offsetSkyLight + i / 2 + 8,   sec->sky_light.begin() + j / 2);
+        }
       }
     }
-    catch (...)
+
+    if (sec->empty()) m_sections[s].reset();
+    else              m_sections[s] = sec;
+  }
+
+  recountSummaries();
+  taint();
+}
+
+void Chunk::freeze()
+{
+  if (m_cold) return;
+
+  // Settle the summaries while we still can.
+  topNonAirY();
+
+  std::shared_ptr<ChunkData> data = std::make_shared<ChunkData>();
+  exportData(*data);
+
+  std::shared_ptr<ColdData> cold = std::make_shared<ColdData>();
+
+  // Palette: slot[b] is the palette index of block type b, or -1 if b doesn't occur.
+
+  std::array<int, 256> slot;
+  slot.fill(-1);
+
+  for (size_t i = 0; i < size_t(sizeBlockType); ++i)
+  {
+    const unsigned char b = (*data)[offsetBlockType + i];
+    if (slot[b] == -1)
     {
-      std::cout << "Exception caught during ZLIB compression!" << std::endl;
+      slot[b] = cold->palette.size();
+      cold->palette.push_back(b);
     }
+  }
+
+  while ((size_t(1) << cold->bits) < cold->palette.size()) ++cold->bits;
+
+  if (cold->bits > 0)
+  {
+    const size_t per_word = 64 / cold->bits;
+    cold->indices.resize((sizeBlockType + per_word - 1) / per_word, 0);
 
-    zlib_buffer_mutex.unlock();
+    for (size_t i = 0; i < size_t(sizeBlockType); ++i)
+      cold->indices[i / per_word] |= uint64_t(slot[(*data)[offsetBlockType + i]]) << ((i % per_word) * cold->bits);
   }
-  else
+
+  // Meta data and light: (run, value) pairs.
+
+  for (size_t i = offsetBlockMetaData; i < data->size(); )
   {
-    std::cout << "PANIC: Access to static ZLIB buffer locked, you MUST rework the threading model." << std::endl;
+    const unsigned char v = (*data)[i];
+    size_t run = 1;
+    while (run < 255 && i + run < data->size() && (*data)[i + run] == v) ++run;
+
+    cold->runs.push_back(run);
+    cold->runs.push_back(v);
+    i += run;
   }
+  cold->runs.shrink_to_fit();
 
-  return result;
+  for (size_t s = 0; s < sectionCount; ++s) m_sections[s].reset();
+  m_cold = cold;
 }
 
+void Chunk::thaw()
+{
+  if (!m_cold) return;
+
+  std::shared_ptr<ChunkData> data = std::make_shared<ChunkData>();
+  m_cold->decode(*data);
+
+  m_cold.reset();
 
-/// This version uses a (rather small) per-chunk zip cache.
-std::pair<const unsigned char *, size_t> Chunk::compress_beefedup()
+  // The content doesn't change, so neither the light nor the deflated copy go stale.
+  const bool lit = m_lit;
+  std::shared_ptr<const std::string> deflated = m_deflated;
+
+  importData(data->data(), data->size());
+
+  m_lit = lit;
+  m_deflated = deflated;
+}
+
+void Chunk::ColdData::decode(ChunkData & data) const
 {
-  if (m_zcache.usable)
+  if (bits == 0)
+  {
+    std::fill(data.begin() + offsetBlockType, data.begin() + offsetBlockType + sizeBlockType, palette.empty() ? 0 : palette[0]);
+  }
+  else
+  {
+    const size_t per_word = 64 / bits;
+    const uint64_t mask = (uint64_t(1) << bits) - 1;
+
+    for (size_t i = 0; i < size_t(sizeBlockType); ++i)
+      data[offsetBlockType + i] = palette[(indices[i / per_word] >> ((i % per_word) * bits)) & mask];
+  }
+
+  size_t i = offsetBlockMetaData;
+  for (size_t k = 0; k + 1 < runs.size(); k += 2)
   {
-    //std::cout << "cached zlib deflate cache hit! (" << std::dec << m_zcache.length << " bytes)" << std::endl;
-    return std::make_pair(m_zcache.cache.data(), m_zcache.length + 18);
+    std::fill(data.begin() + i, data.begin() + i + runs[k], runs[k + 1]);
+    i += runs[k];
   }
+}
+
+std::string Chunk::compress() const
+{
+  /// Our chunks are always 80KiB, so we assume that 100KB suffice for the output and skip the bound check.
+  //unsigned long int outlength = compressBound(size());
 
-  unsigned long int outlength = m_zcache.cache.size() - 18;
-  int zres = ::compress(m_zcache.cache.data() + 18, &outlength, m_data.data(), size());
-  if (zres != Z_OK)
+  std::string result;
+
+  try
   {
-    std::cerr << "Error during beefed-up zlib deflate!" << std::endl;
-    outlength = 0;
+    exportData(export_buffer);
+
+    unsigned long int outlength = zlib_buffer.size();
+    int zres = ::compress(zlib_buffer.data(), &outlength, export_buffer.data(), size());
+    if (zres != Z_OK)
+    {
+      std::cerr << "Error during zlib deflate!" << std::endl;
+    }
+    else
+    {
+      //std::cout << "zlib deflate: " << std::dec << outlength << std::endl;
+      result = std::string(reinterpret_cast<char*>(zlib_buffer.data()), outlength);
+    }
   }
-  else
+  catch (...)
   {
-    //std::cout << "caching zlib deflate: " << std::dec << outlength << std::endl;
-    m_zcache.usable = true;
+    std::cout << "Exception caught during ZLIB compression!" << std::endl;
   }
 
-  m_zcache.writeLength(outlength);
-  m_zcache.length = outlength;
+  return result;
+}
 
-  return std::make_pair(m_zcache.cache.data(), m_zcache.length + 18);
+std::shared_ptr<const std::string> Chunk::compressed() const
+{
+  if (!m_deflated) m_deflated = std::make_shared<const std::string>(compress());
+  return m_deflated;
 }
 
 void Chunk::updateLightAndHeightMaps()
 {
-  // Clear lightmaps
+  // The light maps are about to be rewritten wholesale, bypassing the setters.
+  m_deflated.reset();
 
-  std::fill(m_data.data() + offsetBlockLight, m_data.data() + offsetBlockLight + sizeBlockLight + sizeSkyLight, 0);
+  // Everything above the section containing the topmost non-air block is air and fully lit by the sky.
+  const int top = topNonAirY();
+  const int top_section = top < 0 ? -1 : top / sectionHeight;
+
+  // Clear lightmaps up to that section. Sections above it only need resetting if they're allocated.
+
+  for (int s = 0; s < sectionCount; ++s)
+  {
+    if (s <= top_section)
+    {
+      Section & sec = section(s);
+      sec.block_light.fill(0);
+      sec.sky_light.fill(0);
+    }
+    else if (m_sections[s])
+    {
+      m_sections[s]->block_light.fill(0);
+      m_sections[s]->sky_light.fill(0xFF);
+    }
+  }
 
 
   // Store the highest point that isn't 15 bright.
@@ -132,11 +394,11 @@ void Chunk::updateLightAndHeightMaps()
       int light = 15; //  skySourceLight(ticks);   // It's always 15, the client does the rest
       height(x, z) = 0;
 
-      for (int y = 127; y >= 0; --y)
+      for (int y = top_section * sectionHeight + sectionHeight - 1; y >= 0; --y)
       {
-        const unsigned char & block = blockType(x, y, z);
+        const unsigned char block = blockType(x, y, z);
 
-        light -= int(STOP_LIGHT[block]);
+        light -= int(stopLight(block));
         light = std::max(light, 0);
 
         if (light) setSkyLight(x, y, z, light);
@@ -157,17 +419,22 @@ void Chunk::updateLightAndHeightMaps()
     }
   }
 
-  // Emissive light from certain blocks
+  // Emissive light from certain blocks, if there are any
 
-  for (int x = 0; x < 16; ++x)
-    for (int z = 0; z < 16; ++z)
-      for (int y = first_nonbright_y; y >= 0; --y)  // we don't need to bother if the skylight is already at max
-        if (EMIT_LIGHT[blockType(x, y, z)] > 0)
-        {
-          setBlockLight(x, y, z, EMIT_LIGHT[blockType(x, y, z)]);
-        }
+  if (hasLightEmitters())
+  {
+    for (int x = 0; x < 16; ++x)
+      for (int z = 0; z < 16; ++z)
+        for (int y = first_nonbright_y; y >= 0; --y)  // we don't need to bother if the skylight is already at max
+          if (emitLight(blockType(x, y, z)) > 0)
+          {
+            setBlockLight(x, y, z, emitLight(blockType(x, y, z)));
+          }
+  }
 
+  compactSections();
 
+  m_lit = true;
 }
 
 void Chunk::spreadColumn(size_t x, size_t z, Map & map)
@@ -245,17 +512,17 @@ void Chunk::spreadLightRecursively(const WorldCoords & wc, unsigned char value,
 
   for (size_t direction = 0; direction < 6; ++direction)
   {
-    if      ((lY(wc) == 127) && (direction == BLOCK_YPLUS))  ++direction;     // Going too high
-    else if ((lY(wc) ==   0) && (direction == BLOCK_YMINUS)) ++direction;     // Going too low
+    if      ((wY(wc) == 127) && (direction == BLOCK_YPLUS))  ++direction;     // Going too high
+    else if ((wY(wc) ==   0) && (direction == BLOCK_YMINUS)) ++direction;     // Going too low
 
     WorldCoords to_set = wc + Direction(direction);
 
     if (!map.haveChunk(getChunkCoords(to_set))) continue; // Only spread to chunks that exist.
 
     Chunk & chunk = map.chunk(getChunkCoords(to_set)); // Most times chunk == *this.
-    const unsigned char & block = chunk.blockType(getLocalCoords(to_set));
+    const unsigned char block = chunk.blockType(getLocalCoords(to_set));
 
-    const unsigned char value_new = std::max(0, int(value) - int(STOP_LIGHT[block]) - 1);
+    const unsigned char value_new = std::max(0, int(value) - int(stopLight(block)) - 1);
 
     if (value_new > ( (type == 0) ? chunk.getSkyLight(getLocalCoords(to_set)) : chunk.getBlockLight(getLocalCoords(to_set)) ))
     {
@@ -3,17 +3,29 @@
 
 
 #include <unordered_map>
+#include <string>
 #include <vector>
 #include <array>
 #include <memory>
 #include <boost/noncopyable.hpp>
 #include "types.h"
+#include "chunkmap.h"
 
 class Map;
 
 /* A complete chunk, 16 x 128 x 16.
- * It consists of 4 consecutive arrays of element sizes,
- * respectively, 1, 1/2, 1/2 and 1/2 byte.
+ *
+ * The client expects 4 consecutive arrays of element sizes,
+ * respectively, 1, 1/2, 1/2 and 1/2 byte (see index()).
+ * In memory, however, we store the chunk as eight vertical
+ * sections of 16 x 16 x 16 blocks each, and sections that
+ * are entirely empty (all air, full sky light) are not
+ * allocated at all. The client layout is only assembled
+ * when the chunk is exported, e.g. for compression.
+ *
+ * Chunks that nobody is looking at can be frozen into a much
+ * smaller "cold" form (see freeze()); they thaw on first access
+ * through the map.
  */
  
 class Chunk : private boost::noncopyable
@@ -28,25 +40,31 @@ public:
   // This constructor is only needed by NBTExtract(), and it is implemented in filereader.cpp.
   Chunk(const ChunkCoords & cc, const ChunkData & data, const ChunkHeightMap & hm);
 
-  /// For all sorts of purposes, we need to know if the chunk has been modified.
-  /// We won't do it automatically at every access, please remember to taint your chunk.
+  /// For all sorts of purposes, we need to know if the chunk has been modified. The setters
+  /// take care of this themselves; a tainted chunk needs new light and a new deflated copy.
   inline void taint()
   {
-    m_zcache.usable = false;
-    //std::cout << "Tainting chunk " << coords() << std::endl;
+    m_lit = false;
+    m_deflated.reset();
   }
 
+  /// Whether updateLightAndHeightMaps() has run since the last change of block types.
+  inline bool lit() const { return m_lit; }
+
   /// This is how the client expects the 3D data to be arranged.
   /// (Layers of (y,z)-slices indexed by x, consisting of y-columns indexed by z.)
   inline size_t index(size_t x, size_t y, size_t z) const { return y + (z * 128) + (x * 128 * 16); }
 
+  /// Within a section, the arrangement is the same, only the columns are 16 blocks high.
+  static inline size_t sectionIndex(size_t x, size_t y, size_t z) { return (y & 0x0F) + (z * 16) + (x * 16 * 16); }
+
   /// Meta and light data is only 4 bits, two consecutive fields share one byte.
-  inline unsigned char getHalf(size_t y, unsigned char data) const
+  static inline unsigned char getHalf(size_t y, unsigned char data)
   {
     return (y % 2 == 0) ? (data & 0x0F) : ((data >> 4) & 0x0F);
   }
 
-  inline void setHalf(size_t y, unsigned char value, unsigned char & data)
+  static inline void setHalf(size_t y, unsigned char value, unsigned char & data)
   {
     if (y % 2 == 0)
     {
@@ -62,44 +80,181 @@ public:
     }
   }
 
-  inline size_t size() const { return m_data.size(); }
-  inline const ChunkData & data() const { return m_data; }
-  inline       ChunkData & data()       { return m_data; }
+  /// The size of the chunk in the client layout.
+  inline size_t size() const { return sizeof(ChunkData); }
   inline const ChunkCoords & coords() const { return m_coords; }
 
   enum { offsetBlockType = 0, offsetBlockMetaData = 32768, offsetBlockLight = 49152, offsetSkyLight = 65536,
          sizeBlockType = 32768, sizeBlockMetaData = 16384, sizeBlockLight = 16384, sizeSkyLight = 16384 };
 
+  enum { sectionHeight = 16, sectionCount = 8, sectionVolume = 4096 };
+
+  /// Assemble the chunk in the client layout.
+  void exportData(ChunkData & data) const;
+
+  /// Replace the chunk's content by data given in the client layout. Fields beyond len
+  /// take their defaults: meta data and block light 0, sky light 0xF (full daylight).
+  void importData(const unsigned char * data, size_t len);
+
+  /// The number of allocated sections and the (approximate) memory footprint in bytes.
+  size_t sectionsInUse() const;
+  size_t residentSize() const;
+
+  /// Repack the chunk into its cold form: a palette of the distinct block types with
+  /// bit-packed indices, and run-length encoded meta data and light. While cold,
+  /// only exportData() may be used, and thaw() must be called before anything else.
+  void freeze();
+  void thaw();
+  inline bool cold() const { return bool(m_cold); }
+
+  /// Summaries, which are maintained incrementally and remain valid while the chunk is frozen:
+  /// The number of blocks of a given type, and the highest non-air y-coordinate (-1 if all air).
+  inline size_t blockCount(unsigned char type) const { return m_histogram[type]; }
+  int topNonAirY() const;
+  bool hasLightEmitters() const;
+  bool hasStorageBlocks() const;
+
   inline       unsigned char & height(size_t x, size_t z)       { return m_heightmap[z + 16 * x]; }
   inline const unsigned char & height(size_t x, size_t z) const { return m_heightmap[z + 16 * x]; }
 
 private:
+
+  /// One vertical slice of 16 x 16 x 16 blocks. Unallocated sections are
+  /// all air, with zero meta data and block light and full sky light.
+  struct Section
+  {
+    std::array<unsigned char, sectionVolume>     block_type;
+    std::array<unsigned char, sectionVolume / 2> block_meta;
+    std::array<unsigned char, sectionVolume / 2> block_light;
+    std::array<unsigned char, sectionVolume / 2> sky_light;
+
+    Section() : block_type(), block_meta(), block_light(), sky_light() { sky_light.fill(0xFF); }
+
+    bool empty() const;
+  };
+
+  /// Allocate an empty section (if necessary) because we are about to write non-default data to it.
+  inline Section & section(size_t n)
+  {
+    std::shared_ptr<Section> & s = m_sections[n];
+    if (!s) s = std::make_shared<Section>();
+    return *s;
+  }
+
+  /// Release all sections that have become empty.
+  void compactSections();
+
+  /// Keep the summaries up to date when a block at height y changes from old to val.
+  inline void noteBlockChange(size_t y, unsigned char old, unsigned char val)
+  {
+    --m_histogram[old];
+    ++m_histogram[val];
+
+    if (val != 0 /* air */)
+    {
+      if (old == 0) ++m_solid[y / sectionHeight];
+      if (m_top_valid && int(y) > m_top) m_top = y;
+    }
+    else
+    {
+      --m_solid[y / sectionHeight];
+      if (int(y) == m_top) m_top_valid = false;
+    }
+  }
+
+  /// Rebuild the summaries from scratch.
+  void recountSummaries();
+
+  /// The frozen chunk. The indices into the palette run in client order, as many
+  /// as fit into one 64-bit word; the remaining fields of the client layout
+  /// (everything from offsetBlockMetaData on) are stored as (run, value) byte pairs.
+  struct ColdData
+  {
+    std::vector<unsigned char> palette;
+    unsigned int               bits;     // 0 if the palette has a single entry
+    std::vector<uint64_t>      indices;
+    std::vector<unsigned char> runs;
+
+    ColdData() : palette(), bits(0), indices(), runs() { }
+
+    void decode(ChunkData & data) const;
+  };
+
   // Disallow access to raw coordinates. Save yourself headache!
-  inline       unsigned char & blockType(size_t x, size_t y, size_t z)       { return m_data[offsetBlockType + index(x, y, z)]; }
-  inline const unsigned char & blockType(size_t x, size_t y, size_t z) const { return m_data[offsetBlockType + index(x, y, z)]; }
+  inline unsigned char blockType(size_t x, size_t y, size_t z) const { return blockType(LocalCoords(x, y, z)); }
+  inline void setBlockType(size_t x, size_t y, size_t z, unsigned char val) { setBlockType(LocalCoords(x, y, z), val); }
 
-  inline void setBlockMetaData(size_t x, size_t y, size_t z, unsigned char val) { setHalf(y, val, m_data[offsetBlockMetaData + index(x, y, z) / 2]); }
-  inline unsigned char getBlockMetaData(size_t x, size_t y, size_t z) const { return getHalf(y, m_data[offsetBlockMetaData + index(x, y, z) / 2]); }
+  inline void setBlockMetaData(size_t x, size_t y, size_t z, unsigned char val) { setBlockMetaData(LocalCoords(x, y, z), val); }
+  inline unsigned char getBlockMetaData(size_t x, size_t y, size_t z) const { return getBlockMetaData(LocalCoords(x, y, z)); }
 
-  inline void setBlockLight(size_t x, size_t y, size_t z, unsigned char val) { setHalf(y, val, m_data[offsetBlockLight + index(x, y, z) / 2]); }
-  inline unsigned char getBlockLight(size_t x, size_t y, size_t z) const { return getHalf(y, m_data[offsetBlockLight + index(x, y, z) / 2]); }
+  inline void setBlockLight(size_t x, size_t y, size_t z, unsigned char val) { setBlockLight(LocalCoords(x, y, z), val); }
+  inline unsigned char getBlockLight(size_t x, size_t y, size_t z) const { return getBlockLight(LocalCoords(x, y, z)); }
 
-  inline void setSkyLight(size_t x, size_t y, size_t z, unsigned char val) { setHalf(y, val, m_data[offsetSkyLight + index(x, y, z) / 2]); }
-  inline unsigned char getSkyLight(size_t x, size_t y, size_t z) const { return getHalf(y, m_data[offsetSkyLight + index(x, y, z) / 2]); }
+  inline void setSkyLight(size_t x, size_t y, size_t z, unsigned char val) { setSkyLight(LocalCoords(x, y, z), val); }
+  inline unsigned char getSkyLight(size_t x, size_t y, size_t z) const { return getSkyLight(LocalCoords(x, y, z)); }
 
 public:
-  // Allow only access via explicit coordinate types.
-  inline       unsigned char & blockType(const LocalCoords& lc)              { return blockType(lX(lc), lY(lc), lZ(lc)); }
-  inline const unsigned char & blockType(const LocalCoords& lc)        const { return blockType(lX(lc), lY(lc), lZ(lc)); }
+  // Allow only access via explicit coordinate types. The packed local coordinates
+  // directly give the section and the index within it; the lowest bit is the y-parity.
+  // Above and below the chunk, reads give the defaults (air, no block light, full sky
+  // light) and writes are ignored.
 
-  inline void setBlockMetaData(const LocalCoords & lc, unsigned char val) { setBlockMetaData(lX(lc), lY(lc), lZ(lc), val); }
-  inline unsigned char getBlockMetaData(const LocalCoords & lc) const { return getBlockMetaData(lX(lc), lY(lc), lZ(lc)); }
+  static constexpr bool contains(const LocalCoords & lc) { return lc.section() < sectionCount; }
 
-  inline void setBlockLight(const LocalCoords & lc, unsigned char val) { setBlockLight(lX(lc), lY(lc), lZ(lc), val); }
-  inline unsigned char getBlockLight(const LocalCoords & lc) const { return getBlockLight(lX(lc), lY(lc), lZ(lc)); }
+  inline unsigned char blockType(const LocalCoords & lc) const
+  {
+    if (!contains(lc)) return 0 /* air */;
+    const Section * s = m_sections[lc.section()].get();
+    return s ? s->block_type[lc.sectionIndex()] : 0 /* air */;
+  }
+  inline void setBlockType(const LocalCoords & lc, unsigned char val)
+  {
+    const unsigned char old = blockType(lc);
+    if (old == val || !contains(lc)) return;
 
-  inline void setSkyLight(const LocalCoords & lc, unsigned char val) { setSkyLight(lX(lc), lY(lc), lZ(lc), val); }
-  inline unsigned char getSkyLight(const LocalCoords & lc) const { return getSkyLight(lX(lc), lY(lc), lZ(lc)); }
+    noteBlockChange(lY(lc), old, val);
+    section(lc.section()).block_type[lc.sectionIndex()] = val;
+    taint();
+  }
+
+  inline void setBlockMetaData(const LocalCoords & lc, unsigned char val)
+  {
+    if (val == getBlockMetaData(lc) || !contains(lc)) return;
+    m_deflated.reset();
+    setHalf(lc.index, val, section(lc.section()).block_meta[lc.sectionIndex() / 2]);
+  }
+  inline unsigned char getBlockMetaData(const LocalCoords & lc) const
+  {
+    if (!contains(lc)) return 0;
+    const Section * s = m_sections[lc.section()].get();
+    return s ? getHalf(lc.index, s->block_meta[lc.sectionIndex() / 2]) : 0;
+  }
+
+  inline void setBlockLight(const LocalCoords & lc, unsigned char val)
+  {
+    if (val == getBlockLight(lc) || !contains(lc)) return;
+    m_deflated.reset();
+    setHalf(lc.index, val, section(lc.section()).block_light[lc.sectionIndex() / 2]);
+  }
+  inline unsigned char getBlockLight(const LocalCoords & lc) const
+  {
+    if (!contains(lc)) return 0;
+    const Section * s = m_sections[lc.section()].get();
+    return s ? getHalf(lc.index, s->block_light[lc.sectionIndex() / 2]) : 0;
+  }
+
+  inline void setSkyLight(const LocalCoords & lc, unsigned char val)
+  {
+    if (val == getSkyLight(lc) || !contains(lc)) return;
+    m_deflated.reset();
+    setHalf(lc.index, val, section(lc.section()).sky_light[lc.sectionIndex() / 2]);
+  }
+  inline unsigned char getSkyLight(const LocalCoords & lc) const
+  {
+    if (!contains(lc)) return 15;
+    const Section * s = m_sections[lc.section()].get();
+    return s ? getHalf(lc.index, s->sky_light[lc.sectionIndex() / 2]) : 15;
+  }
 
   /// Compute the chunk's light map and height map.
   /// This function is local and does not need to know any other chunks.
@@ -121,63 +276,40 @@ public:
   void spreadToNewNeighbours(Map & map);
 
   /// The client expects chunks to be deflate()ed. ZLIB to the rescue.
-  /// The beefed-up version uses a local cache if possible.
+  /// Any number of chunks may be compressed concurrently.
   std::string compress() const;
-  std::pair<const unsigned char *, size_t> compress_beefedup();
+
+  /// The same, but kept until the chunk changes. This also works on frozen chunks.
+  std::shared_ptr<const std::string> compressed() const;
 
 private:
   // Own coordinates.
   ChunkCoords m_coords;
 
-  /// Every chunk is exactly 80KiB in size.
-  ChunkData m_data;
+  /// The vertical sections, bottom to top; null means "empty".
+  std::array<std::shared_ptr<Section>, sectionCount> m_sections;
+
+  /// Non-null while the chunk is frozen, in which case there are no sections.
+  std::shared_ptr<ColdData> m_cold;
+
+  /// Block type histogram, non-air blocks per section and the (lazily updated) top non-air block.
+  std::array<uint16_t, 256>          m_histogram;
+  std::array<uint16_t, sectionCount> m_solid;
+  mutable int                        m_top;
+  mutable bool                       m_top_valid;
 
   /// The height map isn't stored, but only used by us in private.
   /// The value at (x, z) is the y-coordinate of the lowest air block reachable from positive infinity; in the range 0 (all air) to 128 (top block non-air).
   ChunkHeightMap m_heightmap;
 
-  struct ZCache
-  {
-    /* First 18 bytes:
-       uint8_t type = PACKET_MAP_CHUNK (0x33)
-       int32_t    X
-       int16_t    Y
-       int32_t    Z
-       uint8_t    size_X = 15, size_Y = 127, size_Z = 15.
-       int32_t    lenght of the subsequent data
-       -------
-       unsigned char data[len]
-    */
-
-    std::array<unsigned char, 10000> cache;
-    size_t length;
-    bool usable;
-
-    ZCache(const ChunkCoords & cc)
-      :
-      cache(),
-      length(0),
-      usable(false)
-    {
-      cache[0] = 0x33;
-      cache[11] = 0x0F; // 15
-      cache[12] = 0x7F; // 127
-      cache[13] = 0x0F; // 15
-
-      WorldCoords wc = getWorldCoords(LocalCoords(0, 0, 0), cc);
-      writeInt32(wX(wc), cache.data() + 1);
-      writeInt16(wY(wc), cache.data() + 5);
-      writeInt32(wZ(wc), cache.data() + 7);
-    }
-
-    static inline void writeInt16(uint16_t x, unsigned char * p) { *p++ = (x >> 8) & 0xFF; *p = x & 0xFF; }
-    static inline void writeInt32(uint32_t x, unsigned char * p) { *p++ = (x >> 24); *p++ = (x >> 16) & 0xFF; *p++ = (x >> 8) & 0xFF; *p = x & 0xFF; }
-    inline void writeLength(size_t len) { writeInt32(len, cache.data() + 14); }
-  } m_zcache;
+  /// See lit() and compressed(). Both survive freezing and thawing.
+  bool                                       m_lit;
+  mutable std::shared_ptr<const std::string> m_deflated;
 };
 
-
-typedef std::unordered_map<ChunkCoords, std::shared_ptr<Chunk>> ChunkMap;
+// Just above the top, far above it, and below the bottom of a chunk must all miss it (placing on a block at y = 127 asks for y = 128).
+static_assert(Chunk::contains(LocalCoords(15, 127, 15)) && !Chunk::contains(LocalCoords(0, 128, 0)) &&
+              !Chunk::contains(LocalCoords(0, 256, 0)) && !Chunk::contains(LocalCoords(0, size_t(-1), 0)), "Chunk height bounds");
 
 
 #endif
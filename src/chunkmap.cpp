@@ -0,0 +1,194 @@
+#include <iostream>
+
+#include "chunkmap.h"
+
+static std::atomic<unsigned int> CHUNKMAP_ID_POOL(0);
+
+ChunkMap::ChunkMap()
+  :
+  m_shards(),
+  m_size(0),
+  m_id(++CHUNKMAP_ID_POOL)
+{
+}
+
+ChunkMap::Shard::Shard()
+  :
+  mutex(),
+  slots(64),
+  mask(63),
+  used(0)
+{
+}
+
+ChunkMap::Slot * ChunkMap::Shard::lookup(const ChunkCoords & cc, size_t h)
+{
+  for (size_t i = h & mask; slots[i].state != Slot::EMPTY; i = (i + 1) & mask)
+  {
+    if (slots[i].cc == cc) return &slots[i];
+  }
+
+  return NULL;
+}
+
+ChunkMap::Slot & ChunkMap::Shard::claim(const ChunkCoords & cc, size_t h)
+{
+  Slot * s = lookup(cc, h);
+  if (s != NULL) return *s;
+
+  // Keep the load factor at or below one half, so that probe sequences stay short.
+  if (2 * (used + 1) > slots.size()) grow();
+
+  size_t i = h & mask;
+  while (slots[i].state != Slot::EMPTY) i = (i + 1) & mask;
+
+  slots[i].cc = cc;
+  ++used;
+
+  return slots[i];
+}
+
+void ChunkMap::Shard::erase(Slot & slot)
+{
+  size_t i = &slot - slots.data();
+
+  // Move back every entry of the following run that would otherwise become unreachable.
+  for (size_t j = (i + 1) & mask; slots[j].state != Slot::EMPTY; j = (j + 1) & mask)
+  {
+    const size_t home = hash(slots[j].cc) & mask;
+
+    const bool reachable = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+    if (reachable) continue;
+
+    slots[i] = std::move(slots[j]);
+    i = j;
+  }
+
+  slots[i] = Slot();
+  --used;
+}
+
+void ChunkMap::Shard::grow()
+{
+  std::vector<Slot> old(2 * slots.size());
+  old.swap(slots);
+
+  mask = slots.size() - 1;
+
+  for (auto it = old.begin(); it != old.end(); ++it)
+  {
+    if (it->state == Slot::EMPTY) continue;
+
+    size_t i = hash(it->cc) & mask;
+    while (slots[i].state != Slot::EMPTY) i = (i + 1) & mask;
+
+    slots[i] = std::move(*it);
+  }
+}
+
+Chunk * ChunkMap::findLocked(const ChunkCoords & cc) const
+{
+  const size_t h = hash(cc);
+  Shard & sh = shard(h);
+
+  std::lock_guard<std::mutex> lock(sh.mutex);
+
+  const Slot * s = sh.lookup(cc, h);
+  return (s != NULL && s->state == Slot::READY) ? s->chunk.get() : NULL;
+}
+
+bool ChunkMap::insert(const value_type & v)
+{
+  if (!v.second) return false;
+
+  const size_t h = hash(v.first);
+  Shard & sh = shard(h);
+
+  std::lock_guard<std::mutex> lock(sh.mutex);
+
+  Slot & s = sh.claim(v.first, h);
+  if (s.state != Slot::EMPTY) return false;
+
+  s.state = Slot::READY;
+  s.chunk = v.second;
+  ++m_size;
+
+  return true;
+}
+
+ChunkMap::mapped_type ChunkMap::getOrCreate(const ChunkCoords & cc, const std::function<mapped_type()> & create)
+{
+  const size_t h = hash(cc);
+  Shard & sh = shard(h);
+
+  std::promise<mapped_type> promise;
+
+  {
+    std::unique_lock<std::mutex> lock(sh.mutex);
+
+    Slot & s = sh.claim(cc, h);
+
+    if (s.state == Slot::READY) return s.chunk;
+
+    if (s.state == Slot::LOADING)
+    {
+      std::shared_future<mapped_type> f = s.loading;
+      lock.unlock();
+      return f.get();
+    }
+
+    s.state = Slot::LOADING;
+    s.loading = promise.get_future().share();
+  }
+
+  // We are the only ones creating this chunk. Slots may move while we're busy, so look it up again afterwards.
+
+  mapped_type chunk;
+
+  try
+  {
+    chunk = create();
+  }
+  catch (...)
+  {
+    std::cerr << "Exception caught while creating chunk " << cc << "!" << std::endl;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(sh.mutex);
+
+    Slot * s = sh.lookup(cc, h);
+
+    if (chunk)
+    {
+      s->state = Slot::READY;
+      s->chunk = chunk;
+      s->loading = std::shared_future<mapped_type>();
+      ++m_size;
+    }
+    else
+    {
+      sh.erase(*s);
+    }
+  }
+
+  promise.set_value(chunk);
+
+  return chunk;
+}
+
+std::vector<ChunkMap::value_type> ChunkMap::snapshot() const
+{
+  std::vector<value_type> result;
+  result.reserve(m_size);
+
+  for (size_t k = 0; k < shardCount; ++k)
+  {
+    std::lock_guard<std::mutex> lock(m_shards[k].mutex);
+
+    for (auto it = m_shards[k].slots.cbegin(); it != m_shards[k].slots.cend(); ++it)
+      if (it->state == Slot::READY) result.push_back(value_type(it->cc, it->chunk));
+  }
+
+  return result;
+}
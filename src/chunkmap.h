@@ -0,0 +1,131 @@
+#ifndef H_CHUNKMAP
+#define H_CHUNKMAP
+
+
+#include <array>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <functional>
+#include <boost/noncopyable.hpp>
+#include "types.h"
+
+class Chunk;
+
+/* The collection of all loaded chunks, safe for concurrent use.
+ *
+ * The map is split into shards, each of which is a flat open-addressing hash
+ * table with linear probing and its own lock; the packed chunk coordinates
+ * pick both the shard and the slot. A slot is either empty, ready, or
+ * "loading": getOrCreate() inserts a placeholder and runs the (slow) creation
+ * function without holding any lock, and everybody else who asks for the same
+ * chunk in the meantime waits for the same future.
+ *
+ * Lookups return a plain pointer, so no reference counts are touched, and each
+ * thread remembers its most recent hit, since consecutive lookups very often
+ * concern the same chunk. Chunks are never removed, so those pointers stay valid.
+ */
+
+class ChunkMap : private boost::noncopyable
+{
+public:
+  typedef std::shared_ptr<Chunk>                mapped_type;
+  typedef std::pair<ChunkCoords, mapped_type>   value_type;
+
+  ChunkMap();
+
+  /// The number of ready chunks.
+  inline size_t size()  const { return m_size; }
+  inline bool   empty() const { return m_size == 0; }
+
+  /// Returns the chunk at cc, or null if there is none (or if it is still loading).
+  inline Chunk * find(const ChunkCoords & cc) const
+  {
+    LastChunk & last = lastChunk();
+    if (last.map == m_id && last.chunk != NULL && last.cc == cc) return last.chunk;
+
+    Chunk * chunk = findLocked(cc);
+    if (chunk != NULL)
+    {
+      last.map   = m_id;
+      last.cc    = cc;
+      last.chunk = chunk;
+    }
+    return chunk;
+  }
+
+  inline size_t count(const ChunkCoords & cc) const { return find(cc) == NULL ? 0 : 1; }
+
+  /// Returns false (and leaves the map unchanged) if a chunk at the same coordinates exists or is loading.
+  bool insert(const value_type & v);
+
+  /// Returns the chunk at cc, calling create() to make it if necessary. Only one thread ever calls
+  /// create() for a given chunk; concurrent callers block until it is done. If create() returns
+  /// null, the placeholder is removed again and all callers get null.
+  mapped_type getOrCreate(const ChunkCoords & cc, const std::function<mapped_type()> & create);
+
+  /// A copy of all ready entries, in no particular order.
+  std::vector<value_type> snapshot() const;
+
+private:
+  enum { shardCount = 16 };
+
+  struct Slot
+  {
+    enum EState { EMPTY = 0, LOADING, READY } state;
+
+    ChunkCoords cc;
+    mapped_type chunk;
+    std::shared_future<mapped_type> loading;
+
+    Slot() : state(EMPTY), cc(), chunk(), loading() { }
+  };
+
+  /// All Shard functions expect the shard's mutex to be held.
+  struct Shard
+  {
+    Shard();
+
+    /// The slot holding cc, or null.
+    Slot * lookup(const ChunkCoords & cc, size_t h);
+
+    /// The slot holding cc, or a fresh empty slot assigned to cc.
+    Slot & claim(const ChunkCoords & cc, size_t h);
+
+    /// Remove an entry (backward-shift deletion, so no tombstones).
+    void erase(Slot & slot);
+
+    /// Double the capacity and reinsert everything.
+    void grow();
+
+    std::mutex        mutex;
+    std::vector<Slot> slots;   // capacity is a power of two
+    size_t            mask;
+    size_t            used;    // non-empty slots
+  };
+
+  struct LastChunk
+  {
+    unsigned int map;
+    ChunkCoords  cc;
+    Chunk *      chunk;
+
+    LastChunk() : map(0), cc(), chunk(NULL) { }
+  };
+
+  static inline LastChunk & lastChunk() { static thread_local LastChunk last; return last; }
+
+  static inline size_t hash(const ChunkCoords & cc) { return std::hash<ChunkCoords>()(cc); }
+  inline Shard & shard(size_t h) const { return m_shards[(h >> 32) & (shardCount - 1)]; }
+
+  Chunk * findLocked(const ChunkCoords & cc) const;
+
+  mutable std::array<Shard, shardCount> m_shards;
+  std::atomic<size_t>                   m_size;
+  const unsigned int                    m_id;   // tells apart the thread-local caches of different maps
+};
+
+
+#endif
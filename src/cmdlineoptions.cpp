@@ -12,6 +12,12 @@ bool parseOptions(int argc, char * argv[], po::variables_map & options)
     ("port,p", po::value<unsigned short int>()->default_value(25565), "Set port to listen on (default: 25565)")
     ("testfile,f", po::value<std::string>()->default_value(""), "Test a region file")
     ("load,r", po::value<std::string>()->default_value(""), "Load map from this file")
+    ("generators,g", po::value<unsigned int>()->default_value(0), "Number of terrain generator threads (default: one per core)")
+    ("noise-quality,q", po::value<unsigned int>()->default_value(0), "Terrain noise sampling: 0 = exact, 1-3 = ever coarser, but faster (default: 0)")
+    ("view-min", po::value<unsigned int>()->default_value(2), "Smallest view distance in chunks that players are cut back to under load (default: 2)")
+    ("view-max", po::value<unsigned int>()->default_value(5), "Largest view distance in chunks that players get when the server is idle (default: 5)")
+    ("chunk-rate", po::value<unsigned int>()->default_value(1024), "Chunk data sent to each player, in KiB per second (default: 1024)")
+    ("chunk-memory", po::value<unsigned int>()->default_value(0), "Shrink view distances while the loaded chunks take more than this many MiB (default: 0, no limit)")
     ;
 
   try
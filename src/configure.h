@@ -0,0 +1,9 @@
+#ifndef H_CONFIGURE
+#define H_CONFIGURE
+
+#define HAVE_LIBNOISE_DIR 
+
+#define USE_INTREE_NOISE
+
+#endif
+
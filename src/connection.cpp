@@ -6,6 +6,7 @@
 
 #include "cmdlineoptions.h"
 #include "connection.h"
+#include "constants.h"
 #include "types.h" // for EID
 
 Connection::Connection(boost::asio::io_service & io_service, ConnectionManager & manager)
@@ -13,7 +14,15 @@ Connection::Connection(boost::asio::io_service & io_service, ConnectionManager &
   m_socket(io_service),
   m_connection_manager(manager),
   m_EID(GenerateEID()),
-  m_nick()
+  m_nick(),
+  m_egress(),
+  m_writing(-1),
+  m_bulk_keys(),
+  m_egress_mutex(),
+  m_pending_bytes(0),
+  m_lane_bytes(),
+  m_congested_since(0),
+  m_overflow(false)
 {
   std::cout << "Connection created." << std::endl;
 }
@@ -50,8 +59,7 @@ void Connection::handleRead(const boost::system::error_code & e, std::size_t byt
       m_local_queue.insert(m_local_queue.end(), m_data.data(), m_data.data() + bytes_transferred);
     }
 
-    // Later, storeReceivedData() may or may not be able to process our queue, but we don't care.
-    // If it succeeds, it will clear the local queue for us.
+    // storeReceivedData() moves the local queue over to the client's SyncQueue and clears it.
     m_connection_manager.storeReceivedData(EID(), m_local_queue);
 
     // Set up the next read operation.
@@ -72,13 +80,110 @@ void Connection::handleRead(const boost::system::error_code & e, std::size_t byt
   }
 }
 
-void Connection::handleWrite(const boost::system::error_code & e)
+bool Connection::sendData(std::string && data, EEgressLane lane, uint64_t key, bool droppable)
+{
+  Egress e(std::move(data), std::shared_ptr<const std::string>(), key);
+  return queue(e, lane, droppable);
+}
+
+bool Connection::sendData(std::string && header, const std::shared_ptr<const std::string> & payload, EEgressLane lane, uint64_t key, bool droppable)
+{
+  Egress e(std::move(header), payload, key);
+  return queue(e, lane, droppable);
+}
+
+bool Connection::queue(Egress & e, EEgressLane lane, bool droppable)
+{
+  std::lock_guard<std::mutex> lock(m_egress_mutex);
+
+  const size_t len = e.size();
+
+  if (droppable && m_congested_since != 0)
+  {
+    BufferPool::release(std::move(e.data));
+    return false;
+  }
+
+  // Once essential data is lost, the stream is broken anyway; we'll disconnect (see hopeless()).
+  if (m_pending_bytes + len > EGRESS_HARD_LIMIT)
+  {
+    m_overflow = true;
+    BufferPool::release(std::move(e.data));
+    return false;
+  }
+
+  // Don't overtake bulk data that this depends on; queue up behind it instead.
+  if (e.key != 0 && lane == EGRESS_INTERACTIVE && m_bulk_keys.count(e.key) > 0) lane = EGRESS_BULK;
+
+  if (e.key != 0 && lane == EGRESS_BULK) ++m_bulk_keys[e.key];
+
+  m_egress[lane].push_back(Egress());
+  std::swap(m_egress[lane].back(), e);
+
+  m_pending_bytes += len;
+  m_lane_bytes[lane] += len;
+
+  if (m_congested_since == 0 && m_pending_bytes > EGRESS_HIGH_WATERMARK) m_congested_since = clockTick();
+
+  // Only one write may be in progress at any time; handleWrite() starts the next one.
+  if (m_writing < 0) startWrite();
+
+  return true;
+}
+
+void Connection::startWrite()
+{
+  m_writing = m_egress[EGRESS_INTERACTIVE].empty() ? EGRESS_BULK : EGRESS_INTERACTIVE;
+
+  // Deque elements stay put when others are added, so the buffers remain valid until the write completes.
+  const Egress & e = m_egress[m_writing].front();
+
+  if (e.payload)
+  {
+    const std::array<boost::asio::const_buffer, 2> buffers = {{ boost::asio::buffer(e.data), boost::asio::buffer(*e.payload) }};
+    boost::asio::async_write(m_socket, buffers, std::bind(&Connection::handleWrite, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+  }
+  else
+  {
+    boost::asio::async_write(m_socket, boost::asio::buffer(e.data), std::bind(&Connection::handleWrite, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+  }
+}
+
+size_t Connection::queuedPackets(EEgressLane lane)
+{
+  std::lock_guard<std::mutex> lock(m_egress_mutex);
+  return m_egress[lane].size();
+}
+
+bool Connection::hopeless() const
+{
+  const long long int since = m_congested_since;
+  return m_overflow || (since != 0 && clockTick() - since > EGRESS_TIMEOUT);
+}
+
+void Connection::handleWrite(const boost::system::error_code & e, std::size_t bytes_transferred)
 {
   if (!e)
   {
-    // Initiate graceful connection closure.
-    //boost::system::error_code ignored_ec;
-    //m_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec);
+    std::lock_guard<std::mutex> lock(m_egress_mutex);
+
+    std::deque<Egress> & q = m_egress[m_writing];
+
+    if (m_writing == EGRESS_BULK && q.front().key != 0)
+    {
+      auto it = m_bulk_keys.find(q.front().key);
+      if (--it->second == 0) m_bulk_keys.erase(it);
+    }
+
+    m_pending_bytes -= bytes_transferred;
+    m_lane_bytes[m_writing] -= bytes_transferred;
+    BufferPool::release(std::move(q.front().data));
+    q.pop_front();
+    m_writing = -1;
+
+    if (m_congested_since != 0 && m_pending_bytes < EGRESS_LOW_WATERMARK) m_congested_since = 0;
+
+    if (!m_egress[EGRESS_INTERACTIVE].empty() || !m_egress[EGRESS_BULK].empty()) startWrite();
   }
   else
   {
@@ -113,13 +218,21 @@ ConnectionManager::ConnectionManager(boost::asio::io_service & io_service)
 
 void ConnectionManager::start(ConnectionPtr c)
 {
-  m_connections.insert(c);
+  {
+    std::lock_guard<std::recursive_mutex> pending_lock(m_pending_mutex);
+    std::lock_guard<std::mutex> lock(m_connections_mutex);
+    m_connections.insert(c);
+  }
   c->start();
 }
 
 void ConnectionManager::stop(ConnectionPtr c)
 {
-  m_connections.erase(c);
+  {
+    std::lock_guard<std::recursive_mutex> pending_lock(m_pending_mutex);
+    std::lock_guard<std::mutex> lock(m_connections_mutex);
+    m_connections.erase(c);
+  }
   c->stop();
 
   // We have to alert the input processing thread that this connection needs to be taked off the "pending" queue.
@@ -127,10 +240,31 @@ void ConnectionManager::stop(ConnectionPtr c)
   m_input_ready_cond.notify_one();
 }
 
+void ConnectionManager::stop(int32_t eid)
+{
+  ConnectionPtr c;
+
+  {
+    std::lock_guard<std::mutex> lock(m_connections_mutex);
+    auto it = findConnectionByEID(eid);
+    if (it == m_connections.end()) return;
+    c = *it;
+  }
+
+  stop(c);
+}
+
 void ConnectionManager::stopAll()
 {
-  std::for_each(m_connections.begin(), m_connections.end(), std::bind(&Connection::stop, std::placeholders::_1));
-  m_connections.clear();
+  std::set<ConnectionPtr> connections;
+
+  {
+    std::lock_guard<std::recursive_mutex> pending_lock(m_pending_mutex);
+    std::lock_guard<std::mutex> lock(m_connections_mutex);
+    connections.swap(m_connections);
+  }
+
+  std::for_each(connections.begin(), connections.end(), std::bind(&Connection::stop, std::placeholders::_1));
 }
 
 void ConnectionManager::storeReceivedData(int32_t eid, std::deque<unsigned char> & local_queue)
@@ -155,8 +289,9 @@ void ConnectionManager::storeReceivedData(int32_t eid, std::deque<unsigned char>
   // Case 1: The queue already exists.
   if (clit != m_client_data.end())
   {
-    // If we can get the lock, we just store the data and are done. If not, no big deal.
-    clit->second->pushMaybeAndClear(local_queue);
+    // This waits for the input thread if it is taking packets off the queue right now. We must
+    // not leave the data behind: the EID is only pending once, and nothing else would pick it up.
+    clit->second->pushAndClear(local_queue);
   }
 
   // Case 2: Queue doesn't exist, we create it. No need to lock m_client_data in this case.
@@ -168,7 +303,7 @@ void ConnectionManager::storeReceivedData(int32_t eid, std::deque<unsigned char>
 
     if (ret.second)
     {
-      ret.first->second->pushMaybeAndClear(local_queue);
+      ret.first->second->pushAndClear(local_queue);
     }
     else
     {
@@ -189,7 +324,26 @@ void ConnectionManager::storeReceivedData(int32_t eid, std::deque<unsigned char>
   m_input_ready_cond.notify_one();
 }
 
-void ConnectionManager::sendDataToClient(int32_t eid, const unsigned char * data, size_t len, const char * debug_message)
+void ConnectionManager::dropHopelessClients()
+{
+  std::vector<int32_t> hopeless;
+
+  {
+    std::lock_guard<std::mutex> lock(m_connections_mutex);
+
+    for (auto it = m_connections.cbegin(); it != m_connections.cend(); ++it)
+      if ((*it)->hopeless()) hopeless.push_back((*it)->EID());
+  }
+
+  for (auto it = hopeless.cbegin(); it != hopeless.cend(); ++it)
+  {
+    std::cout << "Client #" << std::dec << *it << " can't keep up with its data (" << pendingBytes(*it) / 1024 << " KiB waiting), disconnecting." << std::endl;
+    safeStop(*it);
+  }
+}
+
+void ConnectionManager::sendDataToClient(int32_t eid, std::string && data, const char * debug_message,
+                                         EEgressLane lane, uint64_t key, bool droppable)
 {
   std::lock_guard<std::recursive_mutex> lock(m_pending_mutex);
 
@@ -200,6 +354,8 @@ void ConnectionManager::sendDataToClient(int32_t eid, const unsigned char * data
   }
   else
   {
+    const size_t len = data.size();
+
     if (PROGRAM_OPTIONS.count("verbose"))
     {
       std::cout << "Sending data to client #" << std::dec << eid << ", " << len << " bytes. " << (debug_message ? debug_message : "") << std::endl;
@@ -215,11 +371,42 @@ void ConnectionManager::sendDataToClient(int32_t eid, const unsigned char * data
 #if PRINT_EGRESS_DATA > 0
     std::cout << "Sending data to client #" << std::dec << eid << ":";
     for (size_t i = 0; i < len; ++i)
-      std::cout << " " << std::hex << std::setw(2) << std::setfill('0') << (unsigned int)(data[i]);
+      std::cout << " " << std::hex << std::setw(2) << std::setfill('0') << (unsigned int)(unsigned char)(data[i]);
     std::cout << std::endl;
 #endif
 #undef PRINT_EGRESS_DATA
 
-    (*it)->sendData(data, len);
+    if (!(*it)->sendData(std::move(data), lane, key, droppable) && PROGRAM_OPTIONS.count("verbose"))
+    {
+      std::cout << "Client #" << std::dec << eid << " is congested, dropped " << len << " bytes." << std::endl;
+    }
+  }
+}
+
+void ConnectionManager::sendSharedDataToClient(int32_t eid, std::string && header, const std::shared_ptr<const std::string> & payload,
+                                               const char * debug_message, EEgressLane lane, uint64_t key)
+{
+  std::lock_guard<std::recursive_mutex> lock(m_pending_mutex);
+
+  auto it = findConnectionByEID(eid);
+  if (it == m_connections.end())
+  {
+    std::cout << "Client #" << eid << " not available, discarding data." << std::endl;
+  }
+  else
+  {
+    if (PROGRAM_OPTIONS.count("verbose"))
+    {
+      std::cout << "Sending data to client #" << std::dec << eid << ", " << header.size() << " + " << payload->size() << " bytes. "
+                << (debug_message ? debug_message : "") << std::endl;
+    }
+#ifdef DEBUG
+    else if (debug_message)
+    {
+      std::cout << "Sending data to client #" << std::dec << eid << ", " << header.size() << " + " << payload->size() << " bytes. " << debug_message << std::endl;
+    }
+#endif
+
+    (*it)->sendData(std::move(header), payload, lane, key);
   }
 }
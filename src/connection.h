@@ -5,16 +5,27 @@
 #include <memory>
 #include <array>
 #include <deque>
+#include <unordered_map>
 #include <mutex>
+#include <atomic>
 #include <condition_variable>
 #include <boost/asio.hpp>
 #include <boost/noncopyable.hpp>
 
 #include "syncqueue.h"
+#include "bufferpool.h"
 
 class ConnectionManager;
 
 
+/* Outgoing data goes into one of two lanes. Interactive packets (keep-alives, block changes,
+ * chat, movement) overtake queued bulk data (chunks) at packet boundaries, except for bulk
+ * data with the same nonzero ordering key: e.g. a block change never overtakes its chunk.
+ */
+
+enum EEgressLane { EGRESS_INTERACTIVE = 0, EGRESS_BULK = 1, EGRESS_LANES = 2 };
+
+
 /* Class Connection:  represents a single connection from a client, i.e. an active player. */
 
 class Connection : private boost::noncopyable, public std::enable_shared_from_this<Connection>
@@ -51,18 +62,45 @@ public:
   void stop();
 
 
-  /// Send data to client.
+  /// Send data to client. The data is moved into the egress queue of its lane, and written out
+  /// in order within the lane; afterwards, the buffer goes back to the BufferPool. Returns false
+  /// if it was dropped instead: droppable data (which will soon be superseded anyway) while the
+  /// client is congested, and anything at all beyond EGRESS_HARD_LIMIT.
 
-  inline void sendData(const std::string & data)
-  {
-    sendData(reinterpret_cast<const unsigned char *>(data.data()), data.length());
-  }
+  bool sendData(std::string && data, EEgressLane lane = EGRESS_INTERACTIVE, uint64_t key = 0, bool droppable = false);
 
-  inline void sendData(const unsigned char * data, size_t len)
+  inline bool sendData(const unsigned char * data, size_t len, EEgressLane lane = EGRESS_INTERACTIVE, uint64_t key = 0, bool droppable = false)
   {
-    boost::asio::async_write(m_socket, boost::asio::buffer(data, len), std::bind(&Connection::handleWrite, shared_from_this(), std::placeholders::_1));
+    return sendData(BufferPool::copy(reinterpret_cast<const char *>(data), len), lane, key, droppable);
   }
 
+  /// The same for a small header followed by a large shared payload, which is not copied;
+  /// the two are written with a single scatter-gather write.
+
+  bool sendData(std::string && header, const std::shared_ptr<const std::string> & payload,
+                EEgressLane lane = EGRESS_INTERACTIVE, uint64_t key = 0, bool droppable = false);
+
+
+  /// The number of bytes queued for the client, including those being written right now.
+
+  inline size_t pendingBytes() const { return m_pending_bytes; }
+
+
+  /// The depth of one lane: packets and bytes waiting (including one being written).
+
+  size_t queuedPackets(EEgressLane lane);
+
+  inline size_t queuedBytes(EEgressLane lane) const { return m_lane_bytes[lane]; }
+
+
+  /// A client is congested from the moment its queue exceeds EGRESS_HIGH_WATERMARK until
+  /// it drains below EGRESS_LOW_WATERMARK again. Clients that stay congested for longer than
+  /// EGRESS_TIMEOUT, or that would have exceeded the hard limit, are hopeless.
+
+  inline bool congested() const { return m_congested_since != 0; }
+
+  bool hopeless() const;
+
 private:
 
   /// Handle completion of a read operation.
@@ -72,7 +110,19 @@ private:
 
   /// Handle completion of a write operation.
 
-  void handleWrite(const boost::system::error_code & e);
+  void handleWrite(const boost::system::error_code & e, std::size_t bytes_transferred);
+
+
+  /// Write out the front of the most urgent non-empty lane; expects m_egress_mutex to be held.
+
+  void startWrite();
+
+
+  struct Egress;
+
+  /// The common part of the sendData() functions.
+
+  bool queue(Egress & e, EEgressLane lane, bool droppable);
 
   /// Socket for the connection.
 
@@ -106,6 +156,40 @@ private:
   const int32_t m_EID;
 
   std::string m_nick;
+
+
+  /// Outgoing data, one queue per lane, oldest first. The front of lane m_writing is being written.
+
+  struct Egress
+  {
+    Egress() : data(), payload(), key(0) { }
+
+    Egress(std::string && d, const std::shared_ptr<const std::string> & p, uint64_t k) : data(std::move(d)), payload(p), key(k) { }
+
+    std::string data;
+    std::shared_ptr<const std::string> payload; // optional, goes after data
+    uint64_t key;
+
+    inline size_t size() const { return data.size() + (payload ? payload->size() : 0); }
+  };
+
+  std::array<std::deque<Egress>, EGRESS_LANES> m_egress;
+
+  int m_writing; // a lane, or -1 when idle
+
+  /// How many bulk packets with each ordering key are queued.
+
+  std::unordered_map<uint64_t, size_t> m_bulk_keys;
+
+  std::mutex m_egress_mutex;
+
+  std::atomic<size_t> m_pending_bytes;
+
+  std::array<std::atomic<size_t>, EGRESS_LANES> m_lane_bytes;
+
+  std::atomic<long long int> m_congested_since; // clockTick(), or 0
+
+  std::atomic<bool> m_overflow;
 };
 
 typedef std::shared_ptr<Connection> ConnectionPtr;
@@ -140,11 +224,7 @@ public:
 
   void stop(ConnectionPtr c);
 
-  inline void stop(int32_t eid)
-  {
-    auto it = findConnectionByEID(eid);
-    if (it != m_connections.end()) stop(*it);
-  }
+  void stop(int32_t eid);
 
   /// A thread-safe stop that posts to the io_service
 
@@ -172,15 +252,29 @@ public:
 
 
 
-  /// Outgoing data.
+  /// Outgoing data. See Connection::sendData() for the lanes, ordering keys and droppable data.
+  /// Temporaries (like PacketCrafter::craft()) are moved through; everything else is copied into a pooled buffer.
+
+  void sendDataToClient(int32_t eid, std::string && data, const char * debug_message = NULL,
+                        EEgressLane lane = EGRESS_INTERACTIVE, uint64_t key = 0, bool droppable = false);
 
-  void sendDataToClient(int32_t eid, const unsigned char * data, size_t len, const char * debug_message = NULL);
+  inline void sendDataToClient(int32_t eid, const unsigned char * data, size_t len, const char * debug_message = NULL,
+                               EEgressLane lane = EGRESS_INTERACTIVE, uint64_t key = 0, bool droppable = false)
+  {
+    sendDataToClient(eid, BufferPool::copy(reinterpret_cast<const char *>(data), len), debug_message, lane, key, droppable);
+  }
 
-  inline void sendDataToClient(int32_t eid, const std::string & data, const char * debug_message = NULL)
+  inline void sendDataToClient(int32_t eid, const std::string & data, const char * debug_message = NULL,
+                               EEgressLane lane = EGRESS_INTERACTIVE, uint64_t key = 0, bool droppable = false)
   {
-    sendDataToClient(eid, reinterpret_cast<const unsigned char *>(data.data()), data.length(), debug_message);
+    sendDataToClient(eid, BufferPool::copy(data.data(), data.length()), debug_message, lane, key, droppable);
   }
 
+  /// Header plus shared payload, without copying the payload (e.g. map chunks).
+
+  void sendSharedDataToClient(int32_t eid, std::string && header, const std::shared_ptr<const std::string> & payload,
+                              const char * debug_message = NULL, EEgressLane lane = EGRESS_INTERACTIVE, uint64_t key = 0);
+
 
   /// Thread-safe check if a connection exists, by EID.
 
@@ -210,6 +304,33 @@ public:
   }
 
 
+  /// Disconnect all clients that can't keep up with their egress data at all (see Connection::hopeless()).
+
+  void dropHopelessClients();
+
+
+  /// Thread-safe check whether a connection is congested, see Connection::congested().
+
+  inline bool congested(int32_t eid)
+  {
+    std::lock_guard<std::mutex> lock(m_connections_mutex);
+
+    auto it = findConnectionByEID(eid);
+    return it != m_connections.end() && (*it)->congested();
+  }
+
+
+  /// Thread-safe egress backlog of a connection, in bytes.
+
+  inline size_t pendingBytes(int32_t eid)
+  {
+    std::lock_guard<std::mutex> lock(m_connections_mutex);
+
+    auto it = findConnectionByEID(eid);
+    return it != m_connections.end() ? (*it)->pendingBytes() : 0;
+  }
+
+
   /// Synchronisation.
 
   std::recursive_mutex m_cd_mutex;
@@ -245,6 +366,8 @@ private:
   /// The managed connections.
   /// IMPORTANT: This object must only be modified by the IO thread.
   /// All calls to start(), stop(), stopAll() must be inside ASIO callbacks.
+  /// Other threads read it under m_connections_mutex or, in sendDataToClient(), under
+  /// m_pending_mutex, so those modifications take both (m_pending_mutex first).
 
   std::mutex              m_connections_mutex;
   std::set<ConnectionPtr> m_connections;
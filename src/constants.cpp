@@ -27,33 +27,6 @@
 
 #include "constants.h"
 
-// ATTENTION: Packet size EXCLUDES the initial type byte!
-
-PacketInfoMap PACKET_INFO = {
-  { PACKET_KEEP_ALIVE,               { 0,                   "keep-alive"} },
-  { PACKET_LOGIN_REQUEST,            { PACKET_VARIABLE_LEN, "login request"} },
-  { PACKET_HANDSHAKE,                { PACKET_VARIABLE_LEN, "handshake"} },
-  { PACKET_PRE_CHUNK,                { 9,                   "chunk request"} },
-  { PACKET_CHAT_MESSAGE,             { PACKET_VARIABLE_LEN, "chat message"} },
-  { PACKET_USE_ENTITY,               { 9,                   "use entity"} },
-  { PACKET_PLAYER,                   { 1,                   "player"} },
-  { PACKET_PLAYER_POSITION,          { 33,                  "player position"} },
-  { PACKET_PLAYER_LOOK,              { 9,                   "player look"} },
-  { PACKET_PLAYER_POSITION_AND_LOOK, { 41,                  "player pos+look"} },
-  { PACKET_PLAYER_DIGGING,           { 11,                  "player digging"} },
-  { PACKET_PLAYER_BLOCK_PLACEMENT,   { PACKET_VARIABLE_LEN, "player block placement"} },
-  { PACKET_HOLDING_CHANGE,           { 2,                   "player holding change"} },
-  { PACKET_ARM_ANIMATION,            { 5,                   "arm animation"} },
-  { PACKET_PICKUP_SPAWN,             { 22,                  "pickup spawn"} },
-  { PACKET_DISCONNECT,               { PACKET_VARIABLE_LEN, "disconnect"} },
-  { PACKET_RESPAWN,                  { 0,                   "respawn"} },
-  { PACKET_INVENTORY_CHANGE,         { PACKET_VARIABLE_LEN, "inventory change"} },
-  { PACKET_INVENTORY_CLOSE,          { 1,                   "inventory close"} },
-  { PACKET_SIGN,                     { PACKET_VARIABLE_LEN, "sign"} },
-  { PACKET_TRANSACTION,              { 4,                   "transaction"} },
-  { PACKET_ENTITY_CROUCH,            { 5,                   "entity crouch"} }
-};
-
 BlockItemInfoMap BLOCKITEM_INFO = {
   { ITEM_WoodenShovel,     BlockItemInfo("Wooden Shovel") },
   { ITEM_WoodenPickaxe,    BlockItemInfo("Wooden Pickaxe") },
@@ -246,58 +219,96 @@ BlockItemInfoMap BLOCKITEM_INFO = {
   { BLOCK_RedstoneRepeaterOn,    BlockItemInfo("Redstone Repeater (on)") }
   };
 
-PropertyMap EMIT_LIGHT(0, {
-  { BLOCK_Lava, 15 },           // Lava
-  { BLOCK_StationaryLava, 15 }, // Stationary Lava
-  { BLOCK_BrownMushroom,  1 },  // Brown mushroom
-  { BLOCK_Torch, 14 },          // Torch
-  { BLOCK_Fire, 15 },           // Fire
-  { BLOCK_FurnaceBlock, 14 },   // Lit furnace
-  { 0x4A,  9 }, // Redstone ore (Glowing)
-  { 0x4C,  7 }, // Redstone Torch (On)
-  { 0x59, 15 }, // Lightstone
-  { 0x5A, 11 }, // Portal
-  { 0x5B, 15 }, // Jack-O-Lantern
-} );
+/* The block property table.
+ *
+ * Each property is given by a constexpr function of the block type, and
+ * the table is filled by expanding those over an index list 0, ..., 255,
+ * so that the whole thing is a compile-time constant.
+ */
+
+namespace
+{
+  constexpr unsigned char emitLightOf(unsigned int b)
+  {
+    return (b == BLOCK_Lava || b == BLOCK_StationaryLava || b == BLOCK_Fire ||
+            b == 0x59 /* Lightstone */ || b == 0x5B /* Jack-O-Lantern */)  ? 15 :
+           (b == BLOCK_Torch || b == BLOCK_FurnaceBlock /* lit furnace */)  ? 14 :
+           (b == 0x5A /* Portal */)                                         ? 11 :
+           (b == 0x4A /* Redstone ore (glowing) */)                         ?  9 :
+           (b == 0x4C /* Redstone torch (on) */)                            ?  7 :
+           (b == BLOCK_BrownMushroom)                                       ?  1 : 0;
+  }
+
+  constexpr unsigned char stopLightOf(unsigned int b)
+  {
+    return (b == BLOCK_Water || b == BLOCK_StationaryWater ||
+            b == 0x12 /* Leaves */ || b == 0x4F /* Ice */) ? 3 :
+           (b == BLOCK_Air || b == BLOCK_Sapling || b == 0x14 /* Glass */ ||
+            b == 0x25 /* Yellow flower */ || b == 0x26 /* Red rose */ ||
+            b == 0x27 /* Brown mushroom */ || b == 0x28 /* Red mushroom */ ||
+            b == 0x32 /* Torch */ || b == 0x33 /* Fire */ || b == 0x34 /* Mob spawner */ ||
+            b == 0x35 /* Wooden stairs */ || b == 0x37 /* Redstone wire */ ||
+            b == 0x40 /* Wooden door */ || b == 0x41 /* Ladder */ || b == 0x42 /* Minecart track */ ||
+            b == 0x43 /* Cobblestone stairs */ || b == 0x47 /* Iron door */ ||
+            b == 0x4B /* Redstone torch (off) */ || b == 0x4C /* Redstone torch (on) */ ||
+            b == 0x4E /* Snow */ || b == 0x55 /* Fence */ || b == 0x5A /* Portal */ ||
+            b == 0x5B /* Jack-O-Lantern */ || b == BLOCK_SignPost || b == BLOCK_WallSign) ? 0 : 16;
+  }
+
+  constexpr unsigned char digPropertiesOf(unsigned int b)
+  {
+    return (b == BLOCK_Torch) ? LEFTCLICK_REMOVABLE :
+           (b == BLOCK_WoodenDoor || b == BLOCK_IronDoor) ? LEFTCLICK_DIGGABLE | LEFTCLICK_TRIGGER :
+           LEFTCLICK_DIGGABLE;
+  }
+
+  constexpr bool passableOf(unsigned int b)
+  {
+    return b == BLOCK_Torch || b == BLOCK_RedstoneTorchOff || b == BLOCK_RedstoneTorchOn ||
+           b == BLOCK_RedstoneWire || b == BLOCK_Water || b == BLOCK_StationaryWater ||
+           b == BLOCK_Air || b == BLOCK_Rails || b == BLOCK_WoodenDoor || b == BLOCK_IronDoor ||
+           b == BLOCK_SignPost || b == BLOCK_WallSign;
+  }
+
+  constexpr bool buildableOf(unsigned int b)
+  {
+    return b == BLOCK_Water || b == BLOCK_StationaryWater || b == BLOCK_Air;
+  }
+
+  // I don't think this is an official feature.
+  constexpr bool stackableOf(unsigned int b)
+  {
+    return !(b == BLOCK_CraftingTable || b == BLOCK_ChestBlock || b == BLOCK_Jukebox ||
+             b == BLOCK_Torch || b == BLOCK_RedstoneTorchOff || b == BLOCK_RedstoneTorchOn ||
+             b == BLOCK_RedstoneWire || b == BLOCK_Water || b == BLOCK_StationaryWater ||
+             b == BLOCK_Lava || b == BLOCK_StationaryLava || b == BLOCK_Air || b == BLOCK_Rails ||
+             b == BLOCK_WoodenDoor || b == BLOCK_IronDoor || b == BLOCK_Ice || b == BLOCK_Cake ||
+             b == BLOCK_Bed);
+  }
+
+  constexpr bool storageOf(unsigned int b)
+  {
+    return b == BLOCK_ChestBlock || b == BLOCK_FurnaceBlock || b == BLOCK_FurnaceBurningBlock || b == BLOCK_DispenserBlock;
+  }
+
+  constexpr BlockProperties blockProperties(unsigned int b)
+  {
+    return BlockProperties(stopLightOf(b), emitLightOf(b), digPropertiesOf(b),
+                           passableOf(b), buildableOf(b), stackableOf(b), storageOf(b));
+  }
 
-PropertyMap STOP_LIGHT(16, {
-  { BLOCK_Air, 0 },
-  { BLOCK_Sapling, 0 }, // Sapling
-  { BLOCK_Water, 3 }, // Water
-  { BLOCK_StationaryWater, 3 }, // Stationary water
-  { 0x12, 3 }, // Leaves
-  { 0x14, 0 }, // Glass
-  { 0x25, 0 }, // Yellow flower
-  { 0x26, 0 }, // Red rose
-  { 0x27, 0 }, // Brown mushroom
-  { 0x28, 0 }, // Red mushroom
-  { 0x32, 0 }, // Torch
-  { 0x33, 0 }, // Fire
-  { 0x34, 0 }, // Mob spawner
-  { 0x35, 0 }, // Wooden stairs
-  { 0x37, 0 }, // Redstone wire
-  { 0x40, 0 }, // Wooden door
-  { 0x41, 0 }, // Ladder
-  { 0x42, 0 }, // Minecart track
-  { 0x43, 0 }, // Cobblestone stairs
-  { 0x47, 0 }, // Iron door
-  { 0x4b, 0 }, // Redstone Torch (Off)
-  { 0x4C, 0 }, // Redstone Torch (On)
-  { 0x4e, 0 }, // Snow
-  { 0x4f, 3 }, // Ice
-  { 0x55, 0 }, // Fence
-  { 0x5A, 0 }, // Portal
-  { 0x5B, 0 }, // Jack-O-Lantern
-  { BLOCK_SignPost, 0 }, // Sign post
-  { BLOCK_WallSign, 0 }, // Wall sign
-} );
+  template <size_t ...I> struct IndexList { };
+  template <size_t N, size_t ...I> struct MakeIndexList : MakeIndexList<N - 1, N - 1, I...> { };
+  template <size_t ...I> struct MakeIndexList<0, I...> { typedef IndexList<I...> type; };
 
+  template <size_t ...I>
+  constexpr std::array<BlockProperties, sizeof...(I)> makeBlockProperties(IndexList<I...>)
+  {
+    return {{ blockProperties(I)... }};
+  }
+}
 
-PropertyMap BLOCK_DIG_PROPERTIES(LEFTCLICK_DIGGABLE, {
-  { BLOCK_Torch,      LEFTCLICK_REMOVABLE },
-  { BLOCK_WoodenDoor, LEFTCLICK_DIGGABLE | LEFTCLICK_TRIGGER   },
-  { BLOCK_IronDoor,   LEFTCLICK_DIGGABLE | LEFTCLICK_TRIGGER   },
-} );
+constexpr std::array<BlockProperties, 256> BLOCK_PROPERTIES = makeBlockProperties(MakeIndexList<256>::type());
 
-PropertyMap BLOCK_PLACEMENT_PROPERTIES(0, { } );
+static_assert(sizeof(BlockProperties) == sizeof(unsigned int), "BlockProperties should pack into a single word.");
 
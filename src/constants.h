@@ -36,9 +36,32 @@
 
 /// The distance for which chunks need to be available to the client.
 /// An actual (2 r + 1)^2 around the player is sent, see ambientChunks().
+/// This is only where players start; each player's view distance adapts to the load at
+/// run time, between --view-min and --view-max (see GameStateManager::adaptViewDistances()).
 
 enum { PLAYER_CHUNK_HORIZON = 4 }; // Set to 5 for production, 2 for valgrinding. Bravo says "3 or you get spanked". I say "3 is too little".
 
+/// The view distance shrinks when a timer tick (of 200 ms) takes longer than VIEW_BUSY_TICK ms
+/// or when a player's egress backlog exceeds VIEW_BACKLOG_HIGH bytes; it grows again when
+/// things are quiet (VIEW_IDLE_TICK, VIEW_BACKLOG_LOW).
+
+enum { VIEW_BUSY_TICK = 150, VIEW_IDLE_TICK = 100, VIEW_BACKLOG_HIGH = 256 * 1024, VIEW_BACKLOG_LOW = 32 * 1024 };
+
+/// The chunks right around a player, which are sent immediately when they log in; the rest follows
+/// through the chunk scheduler, which spends at most the time budget (ms) per tick.
+
+enum { PLAYER_CHUNK_LOGIN_HORIZON = 1, CHUNK_JOB_TIME_BUDGET = 50 };
+
+/// Egress queue limits per client, in bytes, and how long (ms) a client may stay congested
+/// before we give up on it; see Connection::sendData().
+
+enum { EGRESS_LOW_WATERMARK = 512 * 1024, EGRESS_HIGH_WATERMARK = 2 * 1024 * 1024, EGRESS_HARD_LIMIT = 16 * 1024 * 1024, EGRESS_TIMEOUT = 30000 };
+
+/// Chunks along a moving player's predicted path are generated this many seconds ahead,
+/// with priorities offset so that they come after all chunks that are already in view.
+
+enum { CHUNK_PREFETCH_SECONDS = 4, CHUNK_PREFETCH_PRIORITY = 0x10000 };
+
 
 
 #define PACKET_NEED_MORE_DATA -3
@@ -318,12 +341,6 @@ enum EWindows
 /*********** Info Types ***********/
 
 
-struct PacketInfo
-{
-  size_t size;
-  std::string name;
-};
-
 struct BlockItemInfo
 {
   enum Type { BLOCK = 0, ITEM = 1 };
@@ -334,10 +351,8 @@ struct BlockItemInfo
   std::string name;
 };
 
-typedef std::unordered_map<EPacketNames, PacketInfo, std::hash<size_t>> PacketInfoMap;
 typedef std::unordered_map<EBlockItem, BlockItemInfo, std::hash<size_t>> BlockItemInfoMap;
 
-extern PacketInfoMap PACKET_INFO;
 extern BlockItemInfoMap BLOCKITEM_INFO;
 
 
@@ -383,41 +398,42 @@ struct packet_player_position_and_look
 
 /************ Constants *************/
 
-// Light emission/absorption
-
-struct PropertyMap
-{
-  typedef std::unordered_map<unsigned char, unsigned char> Map;
+// Block properties for digging (left-click) and placement (right-click)
 
-public:
+#define LEFTCLICK_DIGGABLE    0x1
+#define LEFTCLICK_REMOVABLE   0x2
+#define LEFTCLICK_TRIGGER     0x4
 
-  PropertyMap(unsigned char defval, std::initializer_list<Map::value_type> lm)
-  :  m_defval(defval), m_light_map(lm), m_it(), m_end(m_light_map.end())
-  {  }
+/// All static properties of a block type in one entry. The table of all 256 entries,
+/// BLOCK_PROPERTIES, is assembled at compile time in constants.cpp.
 
-  inline unsigned char operator[](unsigned char block)
-  {
-    m_it = m_light_map.find(block);
-    return m_it == m_end ? m_defval : m_it->second;
-  }
-private:
-  const unsigned char    m_defval;
-  const Map           m_light_map;
-        Map::const_iterator  m_it;
-  const Map::const_iterator m_end;
+struct BlockProperties
+{
+  constexpr BlockProperties(unsigned char stop, unsigned char emit, unsigned char dig,
+                            bool passable, bool buildable, bool stackable, bool storage)
+    : stop_light(stop), emit_light(emit), dig(dig),
+      passable(passable), buildable(buildable), stackable(stackable), storage(storage) { }
+
+  unsigned int stop_light : 5;  // light absorption, 0 - 16
+  unsigned int emit_light : 4;  // light emission, 0 - 15
+  unsigned int dig        : 3;  // LEFTCLICK_* flags
+  unsigned int passable   : 1;  // things can pass through this block
+  unsigned int buildable  : 1;  // a new block may be placed in this block
+  unsigned int stackable  : 1;  // a new block may be placed on top of this block
+  unsigned int storage    : 1;  // chests, furnaces, dispensers
 };
 
-extern PropertyMap EMIT_LIGHT;
-extern PropertyMap STOP_LIGHT;
-
-// Block properties for digging (left-click) and placement (right-click)
+extern const std::array<BlockProperties, 256> BLOCK_PROPERTIES;
 
-#define LEFTCLICK_DIGGABLE    0x1
-#define LEFTCLICK_REMOVABLE   0x2
-#define LEFTCLICK_TRIGGER     0x4
+inline unsigned char stopLight(unsigned char block)     { return BLOCK_PROPERTIES[block].stop_light; }
+inline unsigned char emitLight(unsigned char block)     { return BLOCK_PROPERTIES[block].emit_light; }
+inline unsigned char digProperties(unsigned char block) { return BLOCK_PROPERTIES[block].dig; }
+inline bool isStorage(unsigned char block)              { return BLOCK_PROPERTIES[block].storage; }
 
-extern PropertyMap BLOCK_DIG_PROPERTIES;
-extern PropertyMap BLOCK_PLACEMENT_PROPERTIES;
+/// These also accept items, which are neither passable nor buildable, but stackable.
+inline bool isPassable(EBlockItem e)  { return e < 256 && BLOCK_PROPERTIES[e].passable; }
+inline bool isBuildable(EBlockItem e) { return e < 256 && BLOCK_PROPERTIES[e].buildable; }
+inline bool isStackable(EBlockItem e) { return e >= 256 || BLOCK_PROPERTIES[e].stackable; }
 
 
 //Player digging status
@@ -149,8 +149,15 @@ std::shared_ptr<Chunk> NBTExtract(const unsigned char * buf, size_t len, const C
 Chunk::Chunk(const ChunkCoords & cc, const ChunkData & data, const ChunkHeightMap & hm)
   :
   m_coords(cc),
-  m_data(data),
+  m_sections(),
+  m_cold(),
+  m_histogram(),
+  m_solid(),
+  m_top(-1),
+  m_top_valid(false),
   m_heightmap(hm),
-  m_zcache(m_coords)
+  m_lit(false),
+  m_deflated()
 {
+  importData(data.data(), data.size());
 }
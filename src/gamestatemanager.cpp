@@ -2,8 +2,10 @@
 #include <cmath>
 #include <algorithm>
 #include <functional>
+#include <iterator>
 #include <list>
 
+#include "cmdlineoptions.h"
 #include "gamestatemanager.h"
 #include "map.h"
 
@@ -15,6 +17,9 @@ PlayerState::PlayerState(EState s)
   :
   state(s),
   position(), stance(0), pitch(0), yaw(0),
+  view_distance(PLAYER_CHUNK_HORIZON), view_override(0),
+  chunk_bandwidth(),
+  velocity(), last_move(0),
   known_chunks(),
   inventory_ids(),
   inventory_damage(),
@@ -26,6 +31,30 @@ PlayerState::PlayerState(EState s)
   std::fill(inventory_count.begin(), inventory_count.end(), 0);
 }
 
+void PlayerState::moveTo(const RealCoords & rc)
+{
+  const long long int now = clockTick();
+  const double dt = (now - last_move) / 1000.0;
+
+  const double vx = (rX(rc) - rX(position)) / dt;
+  const double vy = (rY(rc) - rY(position)) / dt;
+  const double vz = (rZ(rc) - rZ(position)) / dt;
+
+  // A long pause or a teleport isn't motion; otherwise average over about half a second.
+  if (last_move == 0 || dt <= 0.0 || dt > 1.0 || vx * vx + vz * vz > 100.0 * 100.0)
+  {
+    velocity = RealCoords(0.0, 0.0, 0.0);
+  }
+  else
+  {
+    const double a = dt / (0.5 + dt);
+    velocity = RealCoords(a * vx + (1.0 - a) * rX(velocity), a * vy + (1.0 - a) * rY(velocity), a * vz + (1.0 - a) * rZ(velocity));
+  }
+
+  position  = rc;
+  last_move = now;
+}
+
 /// Returns the horizontal direction of rc relative to the player's
 /// position (this will usally be the negative of what you're thinking
 /// about, but numerically more convenient for the block metadata values).
@@ -52,7 +81,12 @@ Direction PlayerState::getRelativeXZDirection(const RealCoords & rc)
 
 
 GameStateManager::GameStateManager(std::function<void(unsigned int)> sleep, ConnectionManager & connection_manager, Map & map)
-  : sleepMilli(sleep), m_connection_manager(connection_manager), m_map(map), m_states()
+  : sleepMilli(sleep), m_connection_manager(connection_manager), m_map(map), m_states(),
+    m_view_min(std::max(1U, PROGRAM_OPTIONS["view-min"].as<unsigned int>())),
+    m_view_max(std::max(size_t(PROGRAM_OPTIONS["view-max"].as<unsigned int>()), m_view_min)),
+    m_chunk_memory(size_t(PROGRAM_OPTIONS["chunk-memory"].as<unsigned int>()) * 1024 * 1024),
+    m_chunk_rate(PROGRAM_OPTIONS["chunk-rate"].as<unsigned int>() * 1024.0),
+    m_chunk_turn(0)
 {
 }
 
@@ -129,7 +163,7 @@ void GameStateManager::sendToAllExceptOne(std::function<void(int32_t)> f, int32_
     f(*it);
 }
 
-void GameStateManager::sendRawToAll(const std::string & data)
+void GameStateManager::sendRawToAll(std::string data, bool droppable)
 {
   std::list<int32_t> todo;
 
@@ -139,11 +173,10 @@ void GameStateManager::sendRawToAll(const std::string & data)
       todo.push_back(it->first);
   }
 
-  for (auto it = todo.cbegin(); it != todo.cend(); ++it)
-    m_connection_manager.sendDataToClient(*it, data);
+  sendRawToList(todo, std::move(data), droppable);
 }
 
-void GameStateManager::sendRawToAllExceptOne(const std::string & data, int32_t eid)
+void GameStateManager::sendRawToAllExceptOne(std::string data, int32_t eid, bool droppable)
 {
   std::list<int32_t> todo;
 
@@ -154,11 +187,24 @@ void GameStateManager::sendRawToAllExceptOne(const std::string & data, int32_t e
         todo.push_back(it->first);
   }
 
-  for (auto it = todo.cbegin(); it != todo.cend(); ++it)
-    m_connection_manager.sendDataToClient(*it, data);
+  sendRawToList(todo, std::move(data), droppable);
+}
+
+void GameStateManager::sendRawToList(const std::list<int32_t> & eids, std::string && data, bool droppable)
+{
+  // Everybody but the last gets a (pooled) copy; the last one gets the original buffer.
+  for (auto it = eids.cbegin(); it != eids.cend(); ++it)
+  {
+    if (std::next(it) == eids.cend())
+      m_connection_manager.sendDataToClient(*it, std::move(data), NULL, EGRESS_INTERACTIVE, 0, droppable);
+    else
+      m_connection_manager.sendDataToClient(*it, data, NULL, EGRESS_INTERACTIVE, 0, droppable);
+  }
+
+  if (eids.empty()) BufferPool::release(std::move(data));
 }
 
-void GameStateManager::sendMoreChunksToPlayer(int32_t eid)
+void GameStateManager::sendMoreChunksToPlayer(int32_t eid, size_t radius)
 {
   std::lock_guard<std::recursive_mutex> lock(m_gs_mutex);
 
@@ -170,69 +216,351 @@ void GameStateManager::sendMoreChunksToPlayer(int32_t eid)
   // Someone can go and implement more overloads if this looks too icky.
   const ChunkCoords pc = getChunkCoords(getWorldCoords(getFractionalCoords(player.position)));
 
-  std::vector<ChunkCoords> ac = ambientChunks(pc, PLAYER_CHUNK_HORIZON);
+  std::vector<ChunkCoords> ac = ambientChunks(pc, radius);
   std::sort(ac.begin(), ac.end(), L1DistanceFrom(pc));
 
   /// Here follows the typical chunk update acrobatics in three rounds.
 
-  // Round 1: Load all relevant chunks to memory
+  // Round 1: Load all relevant chunks to memory (generating the missing ones in parallel)
 
+  std::vector<ChunkCoords> missing;
   for (auto i = ac.cbegin(); i != ac.cend(); ++i)
-  {
-    if (player.known_chunks.count(*i) > 0) continue;
+    if (player.known_chunks.count(*i) == 0) missing.push_back(*i);
 
+  m_map.ensureChunksAreLoaded(missing, pc);
+
+  // Chunks that have been lit before (e.g. the spawn area, see Map::prepareChunks()) are ready as they are.
+  std::vector<ChunkCoords> fresh;
+
+  for (auto i = missing.cbegin(); i != missing.cend(); ++i)
+  {
     //std::cout << "Player #" << std::dec << eid << " needs chunk " << *i << "." << std::endl;
-    m_map.ensureChunkIsReadyForImmediateUse(*i);
+    if (m_map.ensureChunkIsReadyForImmediateUse(*i)) fresh.push_back(*i);
   }
 
   // Round 2: Spread light to all chunks in memory. Light only spreads to loaded chunks.
 
-  for (auto i = ac.cbegin(); i != ac.cend(); ++i)
+  for (auto i = fresh.cbegin(); i != fresh.cend(); ++i)
   {
-    if (player.known_chunks.count(*i) > 0) continue;
-
     m_map.chunk(*i).spreadAllLight(m_map);
     m_map.chunk(*i).spreadToNewNeighbours(m_map);
   }
 
-  // Round 3: Send the fully updated chunks to the client.
+  // Round 3: Send the fully updated chunks to the client, ahead of any bulk data, since the spawn follows.
   // 3a: Prechunks
-  for (auto i = ac.cbegin(); i != ac.cend(); ++i)
+  for (auto i = missing.cbegin(); i != missing.cend(); ++i)
   {
-    if (player.known_chunks.count(*i) > 0) continue;
+    packetSCPreChunk(eid, *i, true, EGRESS_INTERACTIVE);
+  }
+  // 3b: Actual chunks; the deflated data is kept with the chunk until it changes.
+  for (auto i = missing.cbegin(); i != missing.cend(); ++i)
+  {
+    // Not sure if the client has a problem with data coming in too fast...
+    //sleepMilli(5);
+
+    const std::shared_ptr<const std::string> data = m_map.compressedChunk(*i);
+    packetSCMapChunk(eid, *i, data, EGRESS_INTERACTIVE);
 
-    Chunk & chunk = m_map.chunk(*i);
-    packetSCPreChunk(eid, *i, true);
+    player.known_chunks.insert(*i);
+    player.chunk_bandwidth.tokens -= data->size();
   }
-  // 3b: Actual chunks
-  for (auto i = ac.cbegin(); i != ac.cend(); ++i)
+}
+
+
+namespace
+{
+  struct ChunkJob
   {
-    if (player.known_chunks.count(*i) > 0) continue;
+    int32_t eid;
+    ChunkCoords cc;
+    double score;
 
-    Chunk & chunk = m_map.chunk(*i);
+    inline bool operator<(const ChunkJob & other) const { return score < other.score; }
+  };
 
-    // Not sure if the client has a problem with data coming in too fast...
-    //sleepMilli(5);
+  /// The distance in blocks from the player to the centre of the chunk, times a factor which goes
+  /// from 1/2 for chunks straight ahead over 5/4 on either side to 2 for chunks right behind.
+  double chunkJobScore(const PlayerState & player, const ChunkCoords & cc)
+  {
+    const double dx = 16 * cX(cc) + 8 - rX(player.position);
+    const double dz = 16 * cZ(cc) + 8 - rZ(player.position);
+    const double d  = std::sqrt(dx * dx + dz * dz);
 
-#define USE_ZCACHE 0   // The local chache doesn't seem to work reliably.
-#if USE_ZCACHE > 0
-    // This is using a chunk-local zip cache.
-    std::pair<const unsigned char *, size_t> p = chunk.compress_beefedup();
+    if (d < 1.0) return 0.0;
 
-    if (p.second > 18)
-      packetSCMapChunk(eid, p);
-    else
-      packetSCMapChunk(eid, *i, chunk.compress());
-#else
-    // This is the safe way.
-    packetSCMapChunk(eid, *i, chunk.compress());
-#endif
-#undef USE_ZCACHE
+    // Yaw 0 looks towards +Z, yaw 90 towards -X.
+    const double yaw = player.yaw * M_PI / 180.0;
+    const double cos_angle = (-std::sin(yaw) * dx + std::cos(yaw) * dz) / d;
 
-    player.known_chunks.insert(*i);
+    return d * (1.25 - 0.75 * cos_angle);
+  }
+
+  /// Where the player will be in t seconds if they keep going. Players who haven't
+  /// sent a position update for a while are standing still.
+  RealCoords predictedPosition(const PlayerState & player, double t, long long int now)
+  {
+    if (now - player.last_move > 500) return player.position;
+
+    return RealCoords(rX(player.position) + t * rX(player.velocity), rY(player.position), rZ(player.position) + t * rZ(player.velocity));
   }
 }
 
+void GameStateManager::processChunkJobs()
+{
+  std::lock_guard<std::recursive_mutex> lock(m_gs_mutex);
+
+  const long long int start = clockTick();
+
+  // Everything that is missing, with the best score any player gives it. Recomputing this
+  // on every tick is what reprioritizes the jobs as the players move and turn around.
+
+  std::vector<ChunkJob> jobs, prefetch;
+  std::unordered_map<ChunkCoords, unsigned int> wanted;
+
+  for (auto it = m_states.cbegin(); it != m_states.cend(); ++it)
+  {
+    const PlayerState & player = *it->second;
+    if (player.state != PlayerState::SPAWNED) continue;
+
+    const ChunkCoords pc = getChunkCoords(getWorldCoords(getFractionalCoords(player.position)));
+    const std::vector<ChunkCoords> ac = ambientChunks(pc, player.view_distance);
+    const int32_t view = player.view_distance;
+
+    for (auto i = ac.cbegin(); i != ac.cend(); ++i)
+    {
+      if (player.known_chunks.count(*i) > 0) continue;
+
+      const ChunkJob job = { it->first, *i, chunkJobScore(player, *i) };
+      jobs.push_back(job);
+
+      auto w = wanted.insert(std::make_pair(*i, (unsigned int)(job.score)));
+      if (!w.second) w.first->second = std::min(w.first->second, (unsigned int)(job.score));
+    }
+
+    // Prefetch the chunks that will come into view over the next few seconds, along the
+    // predicted path. They queue behind every visible chunk, so they only use idle workers.
+
+    ChunkCoords last = pc;
+
+    for (int t = 1; t <= CHUNK_PREFETCH_SECONDS; ++t)
+    {
+      const ChunkCoords fc = getChunkCoords(getWorldCoords(getFractionalCoords(predictedPosition(player, t, start))));
+      if (fc == last) continue;
+      last = fc;
+
+      const std::vector<ChunkCoords> fac = ambientChunks(fc, player.view_distance);
+
+      for (auto i = fac.cbegin(); i != fac.cend(); ++i)
+      {
+        const bool in_view = std::abs(cX(*i) - cX(pc)) <= view && std::abs(cZ(*i) - cZ(pc)) <= view;
+        if (in_view || player.known_chunks.count(*i) > 0) continue;
+
+        const ChunkJob job = { it->first, *i, chunkJobScore(player, *i) };
+        const unsigned int priority = CHUNK_PREFETCH_PRIORITY + (unsigned int)(job.score);
+
+        auto w = wanted.insert(std::make_pair(*i, priority));
+        if (w.second) prefetch.push_back(job);
+        else w.first->second = std::min(w.first->second, priority);
+      }
+    }
+  }
+
+  // Chunks nobody wants any more, because their players have moved on or left, are cancelled here.
+  m_map.requestChunks(wanted);
+
+  std::sort(jobs.begin(), jobs.end(), [](const ChunkJob & a, const ChunkJob & b) { return a.eid != b.eid ? a.eid < b.eid : a.score < b.score; });
+  std::sort(prefetch.begin(), prefetch.end());
+
+  // One queue per player, best chunk first. Sockets that are already backed up get nothing,
+  // so that no send buffer balloons.
+
+  struct Queue
+  {
+    PlayerState * player;
+    std::vector<ChunkJob>::const_iterator next, end;
+  };
+
+  std::vector<Queue> queues;
+
+  for (auto j = jobs.cbegin(); j != jobs.cend(); )
+  {
+    auto k = j;
+    while (k != jobs.cend() && k->eid == j->eid) ++k;
+
+    // Up to half a second's worth may be sent in one go.
+    PlayerState & player = *m_states[j->eid];
+    player.chunk_bandwidth.refill(start, m_chunk_rate, m_chunk_rate / 2);
+
+    if (!m_connection_manager.congested(j->eid) && m_connection_manager.pendingBytes(j->eid) < VIEW_BACKLOG_HIGH)
+    {
+      const Queue q = { &player, j, k };
+      queues.push_back(q);
+    }
+
+    j = k;
+  }
+
+  // Send in rounds of one ready chunk per player (who still has an allowance), starting with
+  // somebody else on every tick, until the time is up. Each round is lit before the light spreads.
+
+  if (!queues.empty()) std::rotate(queues.begin(), queues.begin() + m_chunk_turn++ % queues.size(), queues.end());
+
+  std::vector<ChunkJob> round;
+  std::vector<ChunkCoords> fresh;
+
+  while (clockTick() - start < CHUNK_JOB_TIME_BUDGET)
+  {
+    round.clear();
+    fresh.clear();
+
+    for (auto q = queues.begin(); q != queues.end(); ++q)
+    {
+      if (q->player->chunk_bandwidth.tokens <= 0) continue;
+
+      while (q->next != q->end && !m_map.haveChunk(q->next->cc)) ++q->next;
+      if (q->next != q->end) round.push_back(*q->next++);
+    }
+
+    if (round.empty()) break;
+
+    for (auto i = round.cbegin(); i != round.cend(); ++i)
+      if (m_map.ensureChunkIsReadyForImmediateUse(i->cc)) fresh.push_back(i->cc);
+
+    for (auto i = fresh.cbegin(); i != fresh.cend(); ++i)
+    {
+      m_map.chunk(*i).spreadAllLight(m_map);
+      m_map.chunk(*i).spreadToNewNeighbours(m_map);
+    }
+
+    for (auto i = round.cbegin(); i != round.cend(); ++i)
+    {
+      const std::shared_ptr<const std::string> data = m_map.compressedChunk(i->cc);
+
+      packetSCPreChunk(i->eid, i->cc, true);
+      packetSCMapChunk(i->eid, i->cc, data);
+
+      PlayerState & player = *m_states[i->eid];
+      player.known_chunks.insert(i->cc);
+      player.chunk_bandwidth.tokens -= data->size();
+    }
+  }
+
+  // With the time that's left, light and compress the prefetched chunks that have arrived,
+  // so that sending them later costs next to nothing.
+
+  for (auto i = prefetch.cbegin(); i != prefetch.cend() && clockTick() - start < CHUNK_JOB_TIME_BUDGET; ++i)
+  {
+    if (!m_map.haveChunk(i->cc)) continue;
+
+    if (m_map.ensureChunkIsReadyForImmediateUse(i->cc))
+    {
+      m_map.chunk(i->cc).spreadAllLight(m_map);
+      m_map.chunk(i->cc).spreadToNewNeighbours(m_map);
+    }
+
+    m_map.compressedChunk(i->cc);
+  }
+}
+
+
+void GameStateManager::freezeIdleChunks()
+{
+  std::lock_guard<std::recursive_mutex> lock(m_gs_mutex);
+
+  // Keep one extra ring of chunks hot, since light spreads into the neighbours of visible chunks.
+  std::unordered_set<ChunkCoords> keep;
+
+  for (auto it = m_states.cbegin(); it != m_states.cend(); ++it)
+  {
+    if (it->second->state != PlayerState::SPAWNED) continue;
+
+    const ChunkCoords pc = getChunkCoords(getWorldCoords(getFractionalCoords(it->second->position)));
+    std::vector<ChunkCoords> ac = ambientChunks(pc, it->second->view_distance + 1);
+    keep.insert(ac.cbegin(), ac.cend());
+  }
+
+  const size_t n = m_map.freezeChunksExcept(keep);
+
+  if (n > 0)
+  {
+    std::cout << "Froze " << std::dec << n << " idle chunks, " << m_map.coldChunkCount() << " of "
+              << m_map.chunkCount() << " chunks are now cold." << std::endl;
+  }
+}
+
+void GameStateManager::adaptViewDistances(long long int tick_time)
+{
+  std::lock_guard<std::recursive_mutex> lock(m_gs_mutex);
+
+  const size_t memory = m_chunk_memory > 0 ? m_map.residentSize() : 0;
+
+  const bool busy = tick_time > VIEW_BUSY_TICK || (m_chunk_memory > 0 && memory > m_chunk_memory);
+  const bool idle = tick_time < VIEW_IDLE_TICK && (m_chunk_memory == 0 || memory < m_chunk_memory / 10 * 9);
+
+  for (auto it = m_states.begin(); it != m_states.end(); ++it)
+  {
+    PlayerState & player = *it->second;
+    if (player.state != PlayerState::SPAWNED) continue;
+
+    if (player.view_override > 0)
+    {
+      player.view_distance = player.view_override;
+      continue;
+    }
+
+    const size_t backlog = m_connection_manager.pendingBytes(it->first);
+
+    // Back off right away, but only look further once the player has everything within the current view.
+
+    if (busy || backlog > VIEW_BACKLOG_HIGH)
+    {
+      if (player.view_distance > m_view_min) --player.view_distance;
+    }
+    else if (idle && backlog < VIEW_BACKLOG_LOW && player.view_distance < m_view_max)
+    {
+      const ChunkCoords pc = getChunkCoords(getWorldCoords(getFractionalCoords(player.position)));
+      const std::vector<ChunkCoords> ac = ambientChunks(pc, player.view_distance);
+
+      bool complete = true;
+      for (auto i = ac.cbegin(); complete && i != ac.cend(); ++i)
+        complete = player.known_chunks.count(*i) > 0;
+
+      if (complete) ++player.view_distance;
+    }
+
+    player.view_distance = std::min(std::max(player.view_distance, m_view_min), m_view_max);
+  }
+}
+
+bool GameStateManager::setViewDistance(int32_t eid, size_t r)
+{
+  std::lock_guard<std::recursive_mutex> lock(m_gs_mutex);
+
+  auto it = m_states.find(eid);
+  if (it == m_states.end()) return false;
+
+  it->second->view_override = r;
+  if (r > 0) it->second->view_distance = r;
+
+  return true;
+}
+
+void GameStateManager::printViewDistances()
+{
+  std::lock_guard<std::recursive_mutex> lock(m_gs_mutex);
+
+  std::cout << "View distances adapt between " << std::dec << m_view_min << " and " << m_view_max << " chunks";
+  if (m_chunk_memory > 0) std::cout << ", chunk memory " << m_map.residentSize() / 1024 / 1024 << " of " << m_chunk_memory / 1024 / 1024 << " MiB";
+  std::cout << "." << std::endl;
+
+  for (auto it = m_states.cbegin(); it != m_states.cend(); ++it)
+  {
+    std::cout << "  Player #" << std::dec << it->first << ": " << it->second->view_distance << " chunks ("
+              << (it->second->view_override > 0 ? "fixed" : "adaptive") << "), "
+              << it->second->known_chunks.size() << " chunks sent, "
+              << m_connection_manager.pendingBytes(it->first) / 1024 << " KiB waiting to be sent." << std::endl;
+  }
+}
 
 void GameStateManager::sendInventoryToPlayer(int32_t eid)
 {
@@ -300,79 +628,6 @@ uint16_t GameStateManager::updatePlayerInventory(int32_t eid, int16_t type, uint
   return count;
 }
 
-bool isBuildable(EBlockItem e)
-{
-  // Whether or not a new block may be placed in this block
-
-  switch (e)
-    {
-    case BLOCK_Water:
-    case BLOCK_StationaryWater:
-    case BLOCK_Air:
-      return true;
-
-    default:
-      return false;
-    }
-}
-
-bool isPassable(EBlockItem e)
-{
-  // Whether or not things can pass through this block
-
-  switch (e)
-    {
-    case BLOCK_Torch:
-    case BLOCK_RedstoneTorchOff:
-    case BLOCK_RedstoneTorchOn:
-    case BLOCK_RedstoneWire:
-    case BLOCK_Water:
-    case BLOCK_StationaryWater:
-    case BLOCK_Air:
-    case BLOCK_Rails:
-    case BLOCK_WoodenDoor:
-    case BLOCK_IronDoor:
-    case BLOCK_SignPost:
-    case BLOCK_WallSign:
-      return true;
-
-    default:
-      return false;
-    }
-}
-
-bool isStackable(EBlockItem e)
-{
-  // See below; I don't think this is an official feature.
-
-  switch (e)
-    {
-    case BLOCK_CraftingTable:
-    case BLOCK_ChestBlock:
-    case BLOCK_Jukebox:
-    case BLOCK_Torch:
-    case BLOCK_RedstoneTorchOff:
-    case BLOCK_RedstoneTorchOn:
-    case BLOCK_RedstoneWire:
-    case BLOCK_Water:
-    case BLOCK_StationaryWater:
-    case BLOCK_Lava:
-    case BLOCK_StationaryLava:
-    case BLOCK_Air:
-    case BLOCK_Rails:
-    case BLOCK_WoodenDoor:
-    case BLOCK_IronDoor:
-    case BLOCK_Ice:
-    case BLOCK_Cake:
-    case BLOCK_Bed:
-      return false;
-
-    default:
-      return true;
-    }
-}
-
-
 /// Things we have to do when a block gets toggled: swing doors, flip switches.
 
 void GameStateManager::reactToToggle(const WorldCoords & wc, EBlockItem b)
@@ -439,13 +694,15 @@ void GameStateManager::reactToBlockDestruction(const WorldCoords & wc)
 
     if (!m_map.haveChunk(getChunkCoords(wn))) continue;
 
-    unsigned char & block =  m_map.chunk(getChunkCoords(wn)).blockType(getLocalCoords(wn));
+    Chunk & chunk = m_map.chunk(getChunkCoords(wn));
+    unsigned char block = chunk.blockType(getLocalCoords(wn));
 
     if (block == BLOCK_Torch)
     {
       sendToAll(MAKE_CALLBACK(packetSCBlockChange, wn, BLOCK_Air, 0));
       block = BLOCK_Air;
-      m_map.chunk(getChunkCoords(wn)).taint();
+      chunk.setBlockType(getLocalCoords(wn), block);
+      chunk.taint();
       reactToSuccessfulDig(wn, EBlockItem(block));
     }
   }
@@ -456,7 +713,8 @@ void GameStateManager::handlePlayerMove(int32_t eid)
 {
   const PlayerState & player = *m_states[eid];
 
-  sendRawToAllExceptOne(rawPacketSCEntityTeleport(eid, getFractionalCoords(player.position), player.yaw, player.pitch), eid);
+  // The next move will make up for a lost one.
+  sendRawToAllExceptOne(rawPacketSCEntityTeleport(eid, getFractionalCoords(player.position), player.yaw, player.pitch), eid, true);
 
   auto interesting_blocks = m_map.blockAlerts().equal_range(getWorldCoords(player.position));
 
@@ -494,6 +752,9 @@ bool GameStateManager::fall(WorldCoords & wbelow)
 
   const Chunk & chunk = m_map.chunk(getChunkCoords(wbelow));
 
+  // Everything above the topmost non-air block is passable, so skip right to it.
+  if (wY(wbelow) > chunk.topNonAirY() + 1) wY(wbelow) = chunk.topNonAirY() + 1;
+
   for ( ; ; wbelow += BLOCK_YMINUS)
   {
     // An item that drops on something hot or out of the world dies.
@@ -583,13 +844,13 @@ void GameStateManager::reactToSuccessfulDig(const WorldCoords & wc, EBlockItem b
     if (wY(wc) < 127 && chunk.blockType(getLocalCoords(wc + BLOCK_YPLUS)) == block_type)
     {
       sendToAll(MAKE_CALLBACK(packetSCBlockChange, wc + BLOCK_YPLUS, BLOCK_Air, 0));
-      chunk.blockType(getLocalCoords(wc + BLOCK_YPLUS)) = BLOCK_Air;
+      chunk.setBlockType(getLocalCoords(wc + BLOCK_YPLUS), BLOCK_Air);
     }
 
     if (wY(wc) > 0 && chunk.blockType(getLocalCoords(wc + BLOCK_YMINUS)) == block_type)
     {
       sendToAll(MAKE_CALLBACK(packetSCBlockChange, wc + BLOCK_YMINUS, BLOCK_Air, 0));
-      chunk.blockType(getLocalCoords(wc + BLOCK_YMINUS)) = BLOCK_Air;
+      chunk.setBlockType(getLocalCoords(wc + BLOCK_YMINUS), BLOCK_Air);
     }
 
     spawnSomething(block_type == BLOCK_WoodenDoor ? ITEM_WoodenDoor : ITEM_IronDoor, 1, 0, wc);
@@ -771,9 +1032,9 @@ GameStateManager::EBlockPlacement GameStateManager::blockPlacement(int32_t eid,
       sendToAll(MAKE_CALLBACK(packetSCBlockChange, wc + dir + BLOCK_YPLUS, b, meta | 0x8));
 
       Chunk & chunk = m_map.chunk(getChunkCoords(wc + dir));
-      chunk.blockType(getLocalCoords(wc + dir)) = b;
+      chunk.setBlockType(getLocalCoords(wc + dir), b);
       chunk.setBlockMetaData(getLocalCoords(wc + dir), meta);
-      chunk.blockType(getLocalCoords(wc + dir + BLOCK_YPLUS)) = b;
+      chunk.setBlockType(getLocalCoords(wc + dir + BLOCK_YPLUS), b);
       chunk.setBlockMetaData(getLocalCoords(wc + dir + BLOCK_YPLUS), meta | 0x8);
 
       return OK_NO_META;
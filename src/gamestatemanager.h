@@ -1,6 +1,8 @@
 #ifndef H_GAMESTATEMANAGER
 #define H_GAMESTATEMANAGER
 
+#include <algorithm>
+#include <list>
 #include <unordered_map>
 #include <unordered_set>
 #include "connection.h"
@@ -9,6 +11,25 @@
 
 class Map;
 
+/* A token bucket: it fills up at a given rate to a given capacity, and whatever
+ * is sent takes out its size. Spending may overdraw it; the debt is paid back first.
+ */
+
+struct TokenBucket
+{
+  TokenBucket() : tokens(0), last(0) { }
+
+  /// Add what has accrued since the last refill (the first one fills it up); rate is per second, now in ms (clockTick()).
+  inline void refill(long long int now, double rate, double capacity)
+  {
+    tokens = last == 0 ? capacity + tokens : std::min(capacity, tokens + rate * (now - last) / 1000.0);
+    last = now;
+  }
+
+  double tokens;
+  long long int last;
+};
+
 class PlayerState
 {
 public:
@@ -25,6 +46,20 @@ public:
   float pitch;
   float yaw;
 
+  /// The radius of chunks around the player that we send, and the admin's override (0: adapt).
+  size_t view_distance;
+  size_t view_override;
+
+  /// The player's allowance of chunk data, in bytes.
+  TokenBucket chunk_bandwidth;
+
+  /// Smoothed velocity in blocks per second, estimated from the recent position updates.
+  RealCoords velocity;
+  long long int last_move; // clockTick() of the most recent position update
+
+  /// Update the position (and the velocity estimate) from a position packet.
+  void moveTo(const RealCoords & rc);
+
   /// The chunks that we've sent to the player
   std::unordered_set<ChunkCoords> known_chunks;
 
@@ -58,13 +93,18 @@ public:
 
   void update(int32_t);
 
+  /// The game state lock; the input parser holds it while it dispatches a batch of packets.
+  inline std::recursive_mutex & stateMutex() { return m_gs_mutex; }
+
   /// Use with an std::bound-outgoing packet builder below to send a packet to all clients.
   void sendToAll(std::function<void(int32_t)> f);
   void sendToAllExceptOne(std::function<void(int32_t)> f, int32_t eid);
 
   /// Maybe sending raw data is more efficient, not invoking the packet builder each time.
-  void sendRawToAll(const std::string & data);
-  void sendRawToAllExceptOne(const std::string & data, int32_t eid);
+  /// Droppable data is skipped for congested clients (e.g. movement, which is soon superseded).
+  /// The data is taken over and recycled afterwards, so pass a temporary (e.g. a rawPacket*()).
+  void sendRawToAll(std::string data, bool droppable = false);
+  void sendRawToAllExceptOne(std::string data, int32_t eid, bool droppable = false);
 
   /* The following macros are useful for invoking sendToAll().
    * MAKE_CALLBACK is for most handlers
@@ -88,8 +128,26 @@ public:
 #define MAKE_EXPLICIT_CALLBACK(f, ...) std::bind(f, this, std::placeholders::_1, __VA_ARGS__)
 #define MAKE_SIGNED_CALLBACK(p, SIGNATURE, ...) MAKE_EXPLICIT_CALLBACK(  (void (GameStateManager::*)SIGNATURE)(&GameStateManager::p), __VA_ARGS__)
 
-  /// Determine chunks the player might need and send.
-  void sendMoreChunksToPlayer(int32_t eid);
+  /// Send all chunks within the radius that the player doesn't have yet, right now.
+  void sendMoreChunksToPlayer(int32_t eid, size_t radius);
+
+  /// The chunk scheduler, run on every timer tick: queue the chunks that the players are missing,
+  /// nearest and straight ahead first, and send the ready ones, taking turns among the players,
+  /// as far as each player's bandwidth allowance (--chunk-rate) and the time permit.
+  void processChunkJobs();
+
+  /// Freeze the chunks that have not been near any player for a while (see Map::freezeChunksExcept()); runs every 10 seconds.
+  void freezeIdleChunks();
+
+  /// Once a second: let each player's view distance follow the server load. tick_time is
+  /// the longest recent timer tick (ms), the other inputs are the player's egress backlog
+  /// and the memory use of all chunks.
+  void adaptViewDistances(long long int tick_time);
+
+  /// For the console: fix a player's view distance, or let it adapt again (r = 0).
+  /// Returns false if there is no such player.
+  bool setViewDistance(int32_t eid, size_t r);
+  void printViewDistances();
 
   /// Retransmit the entire inventory to the player (45 packets).
   void sendInventoryToPlayer(int32_t eid);
@@ -158,10 +216,9 @@ public:
   void packetSCTime(int32_t eid, int64_t ticks);
   void packetSCOpenWindow(int32_t eid, int8_t window_id, int8_t window_type, std::string title, int8_t slots);
   void packetSCPickupSpawn(int32_t eid, int32_t e, uint16_t type, uint8_t count, uint16_t da, const WorldCoords & wc);
-  void packetSCPreChunk(int32_t eid, const ChunkCoords & cc, bool mode);
-  void packetSCMapChunk(int32_t eid, int32_t X, int32_t Y, int32_t Z, const std::string & data, size_t sizeX = 15, size_t sizeY = 127, size_t sizeZ = 15);
-  inline void packetSCMapChunk(int32_t eid, std::pair<const unsigned char *, size_t> d) { m_connection_manager.sendDataToClient(eid, d.first, d.second); }
-  inline void packetSCMapChunk(int32_t eid, const ChunkCoords & cc, const std::string & data) { packetSCMapChunk(eid, 16 * cX(cc), 0, 16 * cZ(cc), data); }
+  void packetSCPreChunk(int32_t eid, const ChunkCoords & cc, bool mode, EEgressLane lane = EGRESS_BULK);
+  void packetSCMapChunk(int32_t eid, int32_t X, int32_t Y, int32_t Z, const std::shared_ptr<const std::string> & data, size_t sizeX = 15, size_t sizeY = 127, size_t sizeZ = 15, EEgressLane lane = EGRESS_BULK);
+  inline void packetSCMapChunk(int32_t eid, const ChunkCoords & cc, const std::shared_ptr<const std::string> & data, EEgressLane lane = EGRESS_BULK) { packetSCMapChunk(eid, 16 * cX(cc), 0, 16 * cZ(cc), data, 15, 127, 15, lane); }
   void packetSCCollectItem(int32_t eid, int32_t collectee_eid, int32_t collector_eid);
   void packetSCDestroyEntity(int32_t eid, int32_t e);
   void packetSCChatMessage(int32_t eid, std::string message);
@@ -171,14 +228,29 @@ public:
   std::string rawPacketSCDestroyEntity(int32_t e);
 
 private:
+  void sendRawToList(const std::list<int32_t> & eids, std::string && data, bool droppable);
+
   ConnectionManager & m_connection_manager;
   Map & m_map;
  
   std::recursive_mutex m_gs_mutex;
   std::unordered_map<int32_t, std::shared_ptr<PlayerState>> m_states;
+
+  size_t m_view_min, m_view_max;
+  size_t m_chunk_memory;  // bytes, 0: no limit
+
+  double       m_chunk_rate;  // bytes per second and player
+  unsigned int m_chunk_turn;  // who goes first in the next round of chunk sends
 };
 
 
+/// Packets about a chunk are ordered behind the chunk itself in the egress queue (see EEgressLane).
+/// The key is offset by one because 0 means "unordered".
+inline uint64_t egressKey(const ChunkCoords & cc)
+{
+  return cc.key() + 1;
+}
+
 struct L1DistanceFrom
 {
   L1DistanceFrom(const ChunkCoords & cc) : cc(cc) { }
@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+
 #include "generator.h"
 #include "random.h"
 #include "cmdlineoptions.h"
@@ -9,34 +13,127 @@ std::shared_ptr<NoiseGenerator> pNG;
 NoiseGenerator::NoiseGenerator(int mapseed, bool addCaveLava, unsigned int caveSize, double caveThreshold)
   : caveNoise(),
     ridgedMultiNoise(),
+    m_seed(mapseed),
+    m_quality(0),
     m_addCaveLava(addCaveLava),
     m_caveSize(caveSize),
     m_caveThreshold(caveThreshold)
 {
-  int seed = 137337;
-  seed = mapseed;
-
-  if (seed != -1)
+  if (m_seed != -1)
   {
-    std::cout << "Global map seed set by user (" << std::dec << (unsigned int)(seed) << "), thank you." << std::endl;
+    std::cout << "Global map seed set by user (" << std::dec << (unsigned int)(m_seed) << "), thank you." << std::endl;
   }
   else
   {
-    seed = uniformUINT32();
-    std::cout << "Global map seed not set, generating: " << std::dec << (unsigned int)(seed) << std::endl;
+    m_seed = uniformUINT32();
+    std::cout << "Global map seed not set, generating: " << std::dec << (unsigned int)(m_seed) << std::endl;
   }
 
-  caveNoise.SetSeed(seed + 22);
+  configure();
+}
+
+NoiseGenerator::NoiseGenerator(const NoiseGenerator & other)
+  : caveNoise(),
+    ridgedMultiNoise(),
+    m_seed(other.m_seed),
+    m_quality(other.m_quality),
+    m_addCaveLava(other.m_addCaveLava),
+    m_caveSize(other.m_caveSize),
+    m_caveThreshold(other.m_caveThreshold)
+{
+  configure();
+}
+
+void NoiseGenerator::configure()
+{
+  caveNoise.SetSeed(m_seed + 22);
   caveNoise.SetFrequency(1.0 / m_caveSize);
   caveNoise.SetOctaveCount(4);
 
-  ridgedMultiNoise.SetSeed(seed);
+  ridgedMultiNoise.SetSeed(m_seed);
   ridgedMultiNoise.SetOctaveCount(6);
   ridgedMultiNoise.SetFrequency(1.0 / 180.0);
   ridgedMultiNoise.SetLacunarity(2.0);
 }
 
+void NoiseGenerator::heightValues(int32_t x, int32_t z, int32_t dx, size_t n, double * out) const
+{
+  std::vector<double> xs(n), ys(n, 0.0), zs(n, z);
+  for (size_t i = 0; i < n; ++i) xs[i] = x + int32_t(i) * dx;
+
+  sampleNoise(ridgedMultiNoise, n, xs.data(), ys.data(), zs.data(), out);
+}
+
+void NoiseGenerator::caveValues(int32_t x, int32_t y, int32_t z, int32_t dy, size_t n, double * out) const
+{
+  std::vector<double> xs(n, x / 4.0), ys(n), zs(n, z / 4.0);
+  for (size_t i = 0; i < n; ++i) ys[i] = (y + int32_t(i) * dy) / 1.5;
+
+  sampleNoise(caveNoise, n, xs.data(), ys.data(), zs.data(), out);
+}
+
+std::string NoiseGenerator::engineName()
+{
+#ifdef USE_INTREE_NOISE
+  return std::string("in-tree (") + RidgedMultiNoise::simdName() + ")";
+#else
+  return "libnoise";
+#endif
+}
+
+void NoiseGenerator::setQuality(unsigned int quality)
+{
+  m_quality = std::min(quality, (unsigned int)(maxQuality));
+}
+
+namespace
+{
+  /* The coarse-lattice noise values for one chunk. Lattice point (i, j, k) sits
+   * at local coordinates (i * hs, j * vs, k * hs); the horizontal range includes
+   * 16, i.e. the first column of the next chunk. The values of each lattice
+   * column are contiguous, so that they can be sampled in one go.
+   */
+  class NoiseLattice
+  {
+  public:
+    NoiseLattice(int hs, int vs, int layers)
+      : m_hs(hs), m_vs(vs), m_n(16 / hs + 1), m_ny(layers), m_values(m_n * m_n * m_ny) { }
+
+    inline int size()   const { return m_n; }
+    inline int layers() const { return m_ny; }
+
+    inline double * column(int i, int k) { return &at(i, 0, k); }
+
+    /// Trilinear interpolation (bilinear if the lattice is flat).
+    double operator()(int x, int y, int z) const
+    {
+      const int i = x / m_hs, j = y / m_vs, k = z / m_hs;
+      const double u = double(x % m_hs) / m_hs, v = double(y % m_vs) / m_vs, w = double(z % m_hs) / m_hs;
+      const int j1 = std::min(j + 1, m_ny - 1);
+
+      const double c00 = at(i, j,  k) * (1 - u) + at(i + 1, j,  k) * u;
+      const double c01 = at(i, j,  k + 1) * (1 - u) + at(i + 1, j,  k + 1) * u;
+      const double c10 = at(i, j1, k) * (1 - u) + at(i + 1, j1, k) * u;
+      const double c11 = at(i, j1, k + 1) * (1 - u) + at(i + 1, j1, k + 1) * u;
+
+      return ((c00 * (1 - w) + c01 * w) * (1 - v)) + ((c10 * (1 - w) + c11 * w) * v);
+    }
+
+  private:
+    inline       double & at(int i, int j, int k)       { return m_values[j + m_ny * (k + m_n * i)]; }
+    inline const double & at(int i, int j, int k) const { return m_values[j + m_ny * (k + m_n * i)]; }
+
+    const int m_hs, m_vs, m_n, m_ny;
+    std::vector<double> m_values;
+  };
+}
+
 void generateWithNoise(Chunk & c, const ChunkCoords & cc)
+{
+  generateWithNoise(c, cc, *pNG);
+}
+
+void generateWithNoise(Chunk & c, const ChunkCoords & cc, NoiseGenerator & ng)
 {
   const bool winter_enabled = false, add_caves = true;
   const uint8_t sea_level = 64;
@@ -44,20 +141,78 @@ void generateWithNoise(Chunk & c, const ChunkCoords & cc)
   // Winterland or Summerland
   const EBlockItem topBlock = winter_enabled ? BLOCK_Snow : BLOCK_Grass;
 
+  const int x0 = 16 * cX(cc), z0 = 16 * cZ(cc);
+  const bool exact = ng.quality() == 0;
+
+  // Terrain height of each column
+
+  std::array<uint8_t, 16 * 16> heightmap;
+
+  if (exact)
+  {
+    std::array<double, 16> row;
+
+    for (int bZ = 0; bZ < 16; ++bZ)
+    {
+      ng.heightValues(x0, z0 + bZ, 1, 16, row.data());
+
+      for (int bX = 0; bX < 16; ++bX)
+        heightmap[(bZ << 4) + bX] = (uint8_t)((row[bX] * 15) + 64);
+    }
+  }
+  else
+  {
+    NoiseLattice lattice(ng.horizontalStep(), ng.verticalStep(), 1);
+    std::vector<double> row(lattice.size());
+
+    for (int k = 0; k < lattice.size(); ++k)
+    {
+      ng.heightValues(x0, z0 + k * ng.horizontalStep(), ng.horizontalStep(), row.size(), row.data());
+
+      for (int i = 0; i < lattice.size(); ++i)
+        *lattice.column(i, k) = row[i];
+    }
+
+    for (int bX = 0; bX < 16; ++bX)
+      for (int bZ = 0; bZ < 16; ++bZ)
+        heightmap[(bZ << 4) + bX] = (uint8_t)((lattice(bX, 0, bZ) * 15) + 64);
+  }
+
+  // Cave noise, if sampled coarsely, only up to the highest stone block
+
+  std::shared_ptr<NoiseLattice> caves;
+
+  if (add_caves && !exact)
+  {
+    const int stone_max = (*std::max_element(heightmap.begin(), heightmap.end()) * 94) / 100;
+    caves = std::make_shared<NoiseLattice>(ng.horizontalStep(), ng.verticalStep(), stone_max / ng.verticalStep() + 2);
+
+    for (int i = 0; i < caves->size(); ++i)
+      for (int k = 0; k < caves->size(); ++k)
+        ng.caveValues(x0 + i * ng.horizontalStep(), 0, z0 + k * ng.horizontalStep(), ng.verticalStep(), caves->layers(), caves->column(i, k));
+  }
+
   // Populate blocks in chunk
- 
-  //std::array<uint8_t, 16 * 16> heightmap;
 
   for (int bX = 0; bX < 16; ++bX)
   {
     for (int bZ = 0; bZ < 16; ++bZ)
     {
-      //heightmap[(bZ << 4) + bX] = currentHeight = (uint8_t)((NG.ridgedMultiNoise.GetValue(bX + 16 * cX(cc), 0, bZ + 16 * cZ(cc)) * 15) + 64);
-      uint8_t currentHeight = (uint8_t)((pNG->ridgedMultiNoise.GetValue(bX + 16 * cX(cc), 0, bZ + 16 * cZ(cc)) * 15) + 64);
+      const uint8_t currentHeight = heightmap[(bZ << 4) + bX];
 
       const uint8_t stoneHeight = (currentHeight * 94) / 100;
       const uint8_t ymax = std::max(currentHeight, sea_level);
 
+      std::array<double, 256> cave;
+
+      if (add_caves)
+      {
+        if (caves)
+          for (int bY = 0; bY < stoneHeight; ++bY) cave[bY] = (*caves)(bX, bY, bZ);
+        else
+          ng.caveValues(x0 + bX, 0, z0 + bZ, 1, stoneHeight, cave.data());
+      }
+
       for (size_t bY = 0; bY <= ymax; bY++)
       {
         const LocalCoords lc(bX, bY, bZ);
@@ -65,7 +220,7 @@ void generateWithNoise(Chunk & c, const ChunkCoords & cc)
         // Place bedrock
         if (bY == 0)
         {
-          c.blockType(lc) = BLOCK_Bedrock;
+          c.setBlockType(lc, BLOCK_Bedrock);
           continue;
         }
 
@@ -73,43 +228,224 @@ void generateWithNoise(Chunk & c, const ChunkCoords & cc)
         {
           if (bY < stoneHeight)
           {
-            c.blockType(lc) = BLOCK_Stone;
+            uint8_t block = BLOCK_Stone;
 
             // Add caves
-            if (add_caves) pNG->addCaves(c.blockType(lc), getWorldCoords(lc, cc));
+            if (add_caves) ng.carveCave(block, bY, cave[bY]);
+
+            c.setBlockType(lc, block);
           }
           else
           {
-            c.blockType(lc) = BLOCK_Dirt;
+            c.setBlockType(lc, BLOCK_Dirt);
           }
         }
         else if (bY == currentHeight)
         {
           if (bY == sea_level || bY == sea_level - 1 || bY == sea_level - 2)
           {
-            c.blockType(lc) = BLOCK_Sand;  // FF
+            c.setBlockType(lc, BLOCK_Sand);  // FF
           }
           else if (bY < sea_level - 1)
           {
-            c.blockType(lc) = BLOCK_Gravel;  // FF
+            c.setBlockType(lc, BLOCK_Gravel);  // FF
           }
           else
           {
-            c.blockType(lc) = topBlock;  // FF
+            c.setBlockType(lc, topBlock);  // FF
           }
         }
         else
         {
           if (bY <= sea_level)
           {
-            c.blockType(lc) = BLOCK_Water;  // FF
+            c.setBlockType(lc, BLOCK_Water);  // FF
           }
           else
           {
-            c.blockType(lc) = BLOCK_Air;  // FF
+            c.setBlockType(lc, BLOCK_Air);  // FF
           }
         }
       }
     }
   }
 }
+
+
+void benchmarkGenerator(const NoiseGenerator & prototype, size_t chunks)
+{
+  std::vector<std::shared_ptr<Chunk::ChunkData>> reference;
+
+  std::cout << "Generating " << std::dec << chunks << " chunks at each sampling quality, using " << NoiseGenerator::engineName() << " noise:" << std::endl;
+
+  for (unsigned int q = 0; q <= NoiseGenerator::maxQuality; ++q)
+  {
+    NoiseGenerator ng(prototype);
+    ng.setQuality(q);
+
+    size_t differences = 0;
+    auto data = std::make_shared<Chunk::ChunkData>();
+    std::chrono::steady_clock::duration elapsed(0);
+
+    for (size_t n = 0; n < chunks; ++n)
+    {
+      // Spread the sample chunks out a bit, so we see some variety.
+      const ChunkCoords cc(int32_t(n * 7) - 50, int32_t(n * 13) - 50);
+
+      const auto t = std::chrono::steady_clock::now();
+      Chunk chunk(cc);
+      generateWithNoise(chunk, cc, ng);
+      elapsed += std::chrono::steady_clock::now() - t;
+
+      if (q == 0)
+      {
+        reference.push_back(std::make_shared<Chunk::ChunkData>());
+        chunk.exportData(*reference.back());
+        continue;
+      }
+
+      chunk.exportData(*data);
+      for (size_t i = 0; i < size_t(Chunk::sizeBlockType); ++i)
+        if ((*data)[i] != (*reference[n])[i]) ++differences;
+    }
+
+    const size_t n = std::max(chunks, size_t(1));
+
+    std::cout << "  Quality " << q << " (lattice " << ng.horizontalStep() << " x " << ng.verticalStep() << "): "
+              << std::fixed << std::setprecision(2)
+              << std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() / 1000.0 / n << " ms/chunk";
+    if (q > 0) std::cout << ", " << 100.0 * differences / (n * Chunk::sizeBlockType) << "% of blocks differ from quality 0";
+    std::cout << "." << std::endl;
+  }
+}
+
+
+GeneratorPool::GeneratorPool(const NoiseGenerator & prototype, size_t workers)
+  :
+  m_jobs(),
+  m_tasks(),
+  m_queued(0),
+  m_counter(0),
+  m_done(false),
+  m_mutex(),
+  m_cv(),
+  m_threads()
+{
+  for (size_t i = 0; i < std::max(workers, size_t(1)); ++i)
+  {
+    m_threads.push_back(std::thread(&GeneratorPool::work, this, std::make_shared<NoiseGenerator>(prototype)));
+  }
+}
+
+GeneratorPool::~GeneratorPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_done = true;
+  }
+  m_cv.notify_all();
+
+  for (auto it = m_threads.begin(); it != m_threads.end(); ++it) it->join();
+}
+
+void GeneratorPool::enqueue(const ChunkCoords & cc, Task & task, unsigned int priority)
+{
+  task.priority = priority;
+  task.order    = m_counter++;
+
+  // Reprioritizing leaves stale entries behind; don't let them pile up.
+  if (m_jobs.size() > 2 * m_tasks.size() + 64)
+  {
+    std::priority_queue<Job> fresh;
+    for (auto it = m_tasks.cbegin(); it != m_tasks.cend(); ++it)
+      if (!it->second.started && &it->second != &task)
+        fresh.push(Job{ it->second.priority, it->second.order, it->first });
+    m_jobs.swap(fresh);
+  }
+
+  m_jobs.push(Job{ priority, task.order, cc });
+}
+
+GeneratorPool::Future GeneratorPool::submit(const ChunkCoords & cc, unsigned int priority)
+{
+  Future future;
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_tasks.find(cc);
+
+    if (it != m_tasks.end())
+    {
+      if (!it->second.started && it->second.priority != priority) enqueue(cc, it->second, priority);
+      return it->second.future;
+    }
+
+    Task & task = m_tasks[cc];
+    ++m_queued;
+
+    enqueue(cc, task, priority);
+    future = task.future;
+  }
+  m_cv.notify_one();
+
+  return future;
+}
+
+bool GeneratorPool::cancel(const ChunkCoords & cc)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  auto it = m_tasks.find(cc);
+  if (it == m_tasks.end() || it->second.started) return false;
+
+  it->second.promise->set_value(std::shared_ptr<Chunk>());
+  m_tasks.erase(it);
+  --m_queued;
+
+  return true;
+}
+
+size_t GeneratorPool::pending() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_queued;
+}
+
+void GeneratorPool::work(std::shared_ptr<NoiseGenerator> ng)
+{
+  for ( ; ; )
+  {
+    ChunkCoords cc;
+    std::shared_ptr<std::promise<std::shared_ptr<Chunk>>> promise;
+
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      while (!m_done && m_jobs.empty()) m_cv.wait(lock);
+
+      if (m_done) return;
+
+      const Job job = m_jobs.top();
+      m_jobs.pop();
+
+      auto it = m_tasks.find(job.cc);
+      if (it == m_tasks.end() || it->second.order != job.order || it->second.started) continue;
+
+      it->second.started = true;
+      --m_queued;
+
+      cc      = job.cc;
+      promise = it->second.promise;
+    }
+
+    auto chunk = std::make_shared<Chunk>(cc);
+    generateWithNoise(*chunk, cc, *ng);
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_tasks.erase(cc);
+    }
+
+    promise->set_value(chunk);
+  }
+}
@@ -2,11 +2,22 @@
 #define H_GENERATOR
 
 #include <cstdint>
+#include <string>
 #include <memory>
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
+#include <future>
+#include <condition_variable>
+#include <boost/noncopyable.hpp>
 
 #include "configure.h"
 
-#ifdef HAVE_LIBNOISE_DIR
+#ifdef USE_INTREE_NOISE
+#include "gradientnoise.h"
+#elif defined(HAVE_LIBNOISE_DIR)
 #include <libnoise/noise.h>
 #else
 #include <noise/noise.h>
@@ -15,21 +26,74 @@
 #include "constants.h"
 #include "types.h"
 
+/// The noise module behind the terrain, chosen at build time.
+#ifdef USE_INTREE_NOISE
+typedef RidgedMultiNoise NoiseModule;
+
+inline void sampleNoise(const NoiseModule & m, size_t n, const double * x, const double * y, const double * z, double * out)
+{
+  m.GetValues(n, x, y, z, out);
+}
+#else
+typedef noise::module::RidgedMulti NoiseModule;
+
+inline void sampleNoise(const NoiseModule & m, size_t n, const double * x, const double * y, const double * z, double * out)
+{
+  for (size_t i = 0; i < n; ++i) out[i] = m.GetValue(x[i], y[i], z[i]);
+}
+#endif
+
 class NoiseGenerator
 {
 public:
+  /// A seed of -1 means "pick one at random".
   explicit NoiseGenerator(int mapseed, bool addCaveLava = true, unsigned int caveSize = 30, double caveThreshold = 0.5);
 
-  inline void addCaves(uint8_t & block, const WorldCoords & wc)
+  /// Copies are set up from scratch with the same (resolved) seed and parameters,
+  /// so they produce identical terrain. The noise modules themselves cannot be copied.
+  NoiseGenerator(const NoiseGenerator & other);
+
+  /// The terrain noise at n points of a row, starting at (x, z) and spaced dx apart.
+  void heightValues(int32_t x, int32_t z, int32_t dx, size_t n, double * out) const;
+
+  /// The cave noise at n points of a column, starting at (x, y, z) and spaced dy apart.
+  void caveValues(int32_t x, int32_t y, int32_t z, int32_t dy, size_t n, double * out) const;
+
+  /// Carve a cave into a block at height y, given the cave noise value there.
+  inline void carveCave(uint8_t & block, int32_t y, double value) const
   {
-    if (caveNoise.GetValue(wX(wc) / 4.0, wY(wc) / 1.5, wZ(wc) / 4.0) > m_caveThreshold)
-      block = (wY(wc) < 10 && m_addCaveLava) ? BLOCK_Lava : BLOCK_Air;
+    if (value > m_caveThreshold)
+      block = (y < 10 && m_addCaveLava) ? BLOCK_Lava : BLOCK_Air;
   }
 
-  noise::module::RidgedMulti caveNoise;
-  noise::module::RidgedMulti ridgedMultiNoise;
+  inline int seed() const { return m_seed; }
+
+  /* Sampling quality. At quality 0, the noise is evaluated at every column
+   * (terrain height) and every stone block (caves). Higher qualities only
+   * evaluate it on a coarse lattice, with the given spacing, horizontally
+   * and vertically, and interpolate (bi- resp. trilinearly) in between.
+   * The lattice points are at fixed world coordinates, so for any given seed
+   * they agree with the exact values, and neighbouring chunks fit together.
+   */
+  enum { maxQuality = 3 };
+  void setQuality(unsigned int quality);
+  inline unsigned int quality()        const { return m_quality; }
+  inline int          horizontalStep() const { return 1 << m_quality; }
+  inline int          verticalStep()   const { return m_quality == 0 ? 1 : 2 << m_quality; }
+
+  /// "libnoise" or "in-tree (<instruction set>)".
+  static std::string engineName();
+
+  NoiseModule caveNoise;
+  NoiseModule ridgedMultiNoise;
 
 private:
+  NoiseGenerator & operator=(const NoiseGenerator &); // not implemented
+
+  void configure();
+
+  int m_seed;
+  unsigned int m_quality;
   bool m_addCaveLava;
   int m_caveSize;
   double m_caveThreshold;
@@ -40,6 +104,90 @@ extern std::shared_ptr<NoiseGenerator> pNG;
 class Chunk;
 
 void generateWithNoise(Chunk & c, const ChunkCoords & cc);
+void generateWithNoise(Chunk & c, const ChunkCoords & cc, NoiseGenerator & ng);
+
+/// Time the generator at all sampling qualities on a number of chunks and compare the results with the exact ones.
+void benchmarkGenerator(const NoiseGenerator & prototype, size_t chunks);
+
+
+/* A pool of terrain generator threads.
+ *
+ * Each worker owns a copy of the noise generator, so the result is the same
+ * as from generateWithNoise() on the main thread. Jobs are served lowest
+ * priority value first (e.g. the distance from the player who needs the chunk),
+ * and in order of submission among equals. A chunk is only ever queued once;
+ * as long as its job hasn't started, it can be given a new priority or be
+ * cancelled altogether.
+ */
+
+class GeneratorPool : private boost::noncopyable
+{
+public:
+  typedef std::shared_future<std::shared_ptr<Chunk>> Future;
+
+  GeneratorPool(const NoiseGenerator & prototype, size_t workers);
+  ~GeneratorPool();
+
+  /// Queue a chunk for generation; the future yields the complete chunk. If the chunk is
+  /// already queued, it only gets the new priority (and the same future).
+  Future submit(const ChunkCoords & cc, unsigned int priority);
+
+  /// Drop a job that hasn't started yet; its future yields null. Returns false if it was too late.
+  bool cancel(const ChunkCoords & cc);
+
+  /// The number of jobs that haven't been started yet.
+  size_t pending() const;
+
+  inline size_t workers() const { return m_threads.size(); }
+
+private:
+  /// Heap entries; an entry whose order differs from its task's is stale and gets skipped.
+  struct Job
+  {
+    unsigned int priority;
+    unsigned long long int order;
+    ChunkCoords cc;
+
+    inline bool operator<(const Job & other) const // "less urgent than"
+    {
+      return priority != other.priority ? priority > other.priority : order > other.order;
+    }
+  };
+
+  /// A new task is not started yet and comes with its promise and the shared future for it.
+  struct Task
+  {
+    Task()
+      :
+      priority(0),
+      order(0),
+      started(false),
+      promise(std::make_shared<std::promise<std::shared_ptr<Chunk>>>()),
+      future(promise->get_future().share())
+    {
+    }
+
+    unsigned int priority;
+    unsigned long long int order;
+    bool started;
+    std::shared_ptr<std::promise<std::shared_ptr<Chunk>>> promise;
+    Future future;
+  };
+
+  void work(std::shared_ptr<NoiseGenerator> ng);
+
+  /// (Re)queue a task under a fresh order number. Expects the mutex to be held.
+  void enqueue(const ChunkCoords & cc, Task & task, unsigned int priority);
+
+  std::priority_queue<Job>              m_jobs;
+  std::unordered_map<ChunkCoords, Task> m_tasks;
+  size_t                                m_queued;   // tasks not started yet
+  unsigned long long int                m_counter;
+  bool                                  m_done;
+  mutable std::mutex                    m_mutex;
+  std::condition_variable               m_cv;
+  std::vector<std::thread>              m_threads;
+};
 
 
 #endif
@@ -0,0 +1,278 @@
+#include <cmath>
+#include <random>
+#include <algorithm>
+
+#include "gradientnoise.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+  /* A handful of doubles that are processed together. Only the operations which
+   * the noise kernel needs are provided; the hashing is done lane by lane.
+   */
+
+#if defined(__AVX__)
+
+  struct Lanes
+  {
+    enum { width = 4 };
+
+    explicit Lanes(__m256d w) : v(w) { }
+    explicit Lanes(double a) : v(_mm256_set1_pd(a)) { }
+
+    static inline Lanes load(const double * p) { return Lanes(_mm256_loadu_pd(p)); }
+    // Building the vector from scalars beats AVX2's gather instruction here.
+    static inline Lanes gather(const double * t, const int * i) { return Lanes(_mm256_setr_pd(t[i[0]], t[i[1]], t[i[2]], t[i[3]])); }
+    inline void store(double * p) const { _mm256_storeu_pd(p, v); }
+
+    friend inline Lanes operator+(Lanes a, Lanes b) { return Lanes(_mm256_add_pd(a.v, b.v)); }
+    friend inline Lanes operator-(Lanes a, Lanes b) { return Lanes(_mm256_sub_pd(a.v, b.v)); }
+    friend inline Lanes operator*(Lanes a, Lanes b) { return Lanes(_mm256_mul_pd(a.v, b.v)); }
+
+    friend inline Lanes floor(Lanes a) { return Lanes(_mm256_floor_pd(a.v)); }
+    friend inline Lanes abs(Lanes a)   { return Lanes(_mm256_andnot_pd(_mm256_set1_pd(-0.0), a.v)); }
+    friend inline Lanes clamp01(Lanes a) { return Lanes(_mm256_min_pd(_mm256_max_pd(a.v, _mm256_setzero_pd()), _mm256_set1_pd(1.0))); }
+
+    __m256d v;
+  };
+
+  const char * const SIMD_NAME = "AVX";
+
+#elif defined(__SSE2__)
+
+  struct Lanes
+  {
+    enum { width = 2 };
+
+    explicit Lanes(__m128d w) : v(w) { }
+    explicit Lanes(double a) : v(_mm_set1_pd(a)) { }
+
+    static inline Lanes load(const double * p) { return Lanes(_mm_loadu_pd(p)); }
+    static inline Lanes gather(const double * t, const int * i) { return Lanes(_mm_setr_pd(t[i[0]], t[i[1]])); }
+    inline void store(double * p) const { _mm_storeu_pd(p, v); }
+
+    friend inline Lanes operator+(Lanes a, Lanes b) { return Lanes(_mm_add_pd(a.v, b.v)); }
+    friend inline Lanes operator-(Lanes a, Lanes b) { return Lanes(_mm_sub_pd(a.v, b.v)); }
+    friend inline Lanes operator*(Lanes a, Lanes b) { return Lanes(_mm_mul_pd(a.v, b.v)); }
+
+    // SSE2 has no rounding instruction: truncate, then step down where that rounded up.
+    friend inline Lanes floor(Lanes a)
+    {
+      const __m128d t = _mm_cvtepi32_pd(_mm_cvttpd_epi32(a.v));
+      return Lanes(_mm_sub_pd(t, _mm_and_pd(_mm_cmpgt_pd(t, a.v), _mm_set1_pd(1.0))));
+    }
+    friend inline Lanes abs(Lanes a)   { return Lanes(_mm_andnot_pd(_mm_set1_pd(-0.0), a.v)); }
+    friend inline Lanes clamp01(Lanes a) { return Lanes(_mm_min_pd(_mm_max_pd(a.v, _mm_setzero_pd()), _mm_set1_pd(1.0))); }
+
+    __m128d v;
+  };
+
+  const char * const SIMD_NAME = "SSE2";
+
+#else
+
+  struct Lanes
+  {
+    enum { width = 1 };
+
+    explicit Lanes(double a) : v(a) { }
+
+    static inline Lanes load(const double * p) { return Lanes(*p); }
+    static inline Lanes gather(const double * t, const int * i) { return Lanes(t[*i]); }
+    inline void store(double * p) const { *p = v; }
+
+    friend inline Lanes operator+(Lanes a, Lanes b) { return Lanes(a.v + b.v); }
+    friend inline Lanes operator-(Lanes a, Lanes b) { return Lanes(a.v - b.v); }
+    friend inline Lanes operator*(Lanes a, Lanes b) { return Lanes(a.v * b.v); }
+
+    friend inline Lanes floor(Lanes a)   { return Lanes(std::floor(a.v)); }
+    friend inline Lanes abs(Lanes a)     { return Lanes(std::fabs(a.v)); }
+    friend inline Lanes clamp01(Lanes a) { return Lanes(std::min(std::max(a.v, 0.0), 1.0)); }
+
+    double v;
+  };
+
+  const char * const SIMD_NAME = "scalar";
+
+#endif
+
+  enum { W = Lanes::width };
+
+  /// The twelve cube edge directions, padded to sixteen (Perlin's "improved noise"), by component.
+  const double GRADIENT_X[16] = { 1, -1,  1, -1,  1, -1,  1, -1,  0,  0,  0,  0,  1, -1,  0,  0 };
+  const double GRADIENT_Y[16] = { 1,  1, -1, -1,  0,  0,  0,  0,  1, -1,  1, -1,  1,  1, -1, -1 };
+  const double GRADIENT_Z[16] = { 0,  0,  0,  0,  1,  1, -1, -1,  1,  1, -1, -1,  0,  0,  1, -1 };
+
+  inline Lanes fade(Lanes t) { return t * t * t * (t * (t * Lanes(6.0) - Lanes(15.0)) + Lanes(10.0)); }
+  inline Lanes lerp(Lanes t, Lanes a, Lanes b) { return a + t * (b - a); }
+
+  /// Gradient noise at W points, roughly in [-1, 1].
+  Lanes gradientNoise(const uint8_t * p, Lanes x, Lanes y, Lanes z)
+  {
+    const Lanes x0 = floor(x), y0 = floor(y), z0 = floor(z);
+    const Lanes fx = x - x0, fy = y - y0, fz = z - z0;
+
+    double ix[W], iy[W], iz[W];
+    x0.store(ix);
+    y0.store(iy);
+    z0.store(iz);
+
+    // The gradient indices at the eight cell corners; corner c is at (c & 1, (c >> 1) & 1, c >> 2).
+    int h[8][W];
+
+    for (int i = 0; i < W; ++i)
+    {
+      const int X = int(ix[i]) & 255, Y = int(iy[i]) & 255, Z = int(iz[i]) & 255;
+
+      const int A = p[X] + Y, AA = p[A] + Z, AB = p[A + 1] + Z;
+      const int B = p[X + 1] + Y, BA = p[B] + Z, BB = p[B + 1] + Z;
+
+      h[0][i] = p[AA] & 15;     h[1][i] = p[BA] & 15;     h[2][i] = p[AB] & 15;     h[3][i] = p[BB] & 15;
+      h[4][i] = p[AA + 1] & 15; h[5][i] = p[BA + 1] & 15; h[6][i] = p[AB + 1] & 15; h[7][i] = p[BB + 1] & 15;
+    }
+
+    const Lanes one(1.0);
+    const Lanes dx[2] = { fx, fx - one }, dy[2] = { fy, fy - one }, dz[2] = { fz, fz - one };
+
+    auto d = [&](int c)
+    {
+      return Lanes::gather(GRADIENT_X, h[c]) * dx[c & 1] + Lanes::gather(GRADIENT_Y, h[c]) * dy[(c >> 1) & 1] + Lanes::gather(GRADIENT_Z, h[c]) * dz[c >> 2];
+    };
+
+    const Lanes u = fade(fx), v = fade(fy), w = fade(fz);
+
+    return lerp(w, lerp(v, lerp(u, d(0), d(1)), lerp(u, d(2), d(3))),
+                   lerp(v, lerp(u, d(4), d(5)), lerp(u, d(6), d(7))));
+  }
+}
+
+RidgedMultiNoise::RidgedMultiNoise()
+  :
+  m_seed(0),
+  m_frequency(1.0),
+  m_lacunarity(2.0),
+  m_octaves(6),
+  m_permutations(),
+  m_spectralWeights()
+{
+  update();
+}
+
+void RidgedMultiNoise::SetSeed(int seed)
+{
+  m_seed = seed;
+  update();
+}
+
+void RidgedMultiNoise::SetFrequency(double frequency)
+{
+  m_frequency = frequency;
+}
+
+void RidgedMultiNoise::SetLacunarity(double lacunarity)
+{
+  m_lacunarity = lacunarity;
+  update();
+}
+
+void RidgedMultiNoise::SetOctaveCount(int octaves)
+{
+  m_octaves = std::min(std::max(octaves, 1), int(maxOctaves));
+  update();
+}
+
+void RidgedMultiNoise::update()
+{
+  m_permutations.resize(m_octaves);
+  m_spectralWeights.resize(m_octaves);
+
+  double frequency = 1.0;
+
+  for (int o = 0; o < m_octaves; ++o)
+  {
+    // mt19937 is fully specified, and we don't use any distributions (which aren't),
+    // so the terrain for a given seed is the same on every platform.
+    std::mt19937 gen(uint32_t(m_seed + o));
+
+    Permutation & p = m_permutations[o];
+    for (int i = 0; i < 256; ++i) p[i] = uint8_t(i);
+    for (int i = 255; i > 0; --i) std::swap(p[i], p[gen() % (i + 1)]);
+    std::copy(p.begin(), p.begin() + 256, p.begin() + 256);
+
+    m_spectralWeights[o] = 1.0 / frequency;
+    frequency *= m_lacunarity;
+  }
+}
+
+double RidgedMultiNoise::GetValue(double x, double y, double z) const
+{
+  double result;
+  GetValues(1, &x, &y, &z, &result);
+  return result;
+}
+
+void RidgedMultiNoise::GetValues(size_t n, const double * x, const double * y, const double * z, double * out) const
+{
+  // The last, partial group goes through a padded copy.
+  double px[W], py[W], pz[W], pout[W];
+
+  for (size_t k = 0; k < n; k += W)
+  {
+    const bool partial = n - k < size_t(W);
+
+    if (partial)
+    {
+      std::fill(px, px + W, 0.0);
+      std::fill(py, py + W, 0.0);
+      std::fill(pz, pz + W, 0.0);
+      std::copy(x + k, x + n, px);
+      std::copy(y + k, y + n, py);
+      std::copy(z + k, z + n, pz);
+    }
+
+    const Lanes f(m_frequency), lacunarity(m_lacunarity), two(2.0);
+
+    Lanes X = Lanes::load(partial ? px : x + k) * f;
+    Lanes Y = Lanes::load(partial ? py : y + k) * f;
+    Lanes Z = Lanes::load(partial ? pz : z + k) * f;
+
+    Lanes value(0.0), weight(1.0);
+
+    for (int o = 0; o < m_octaves; ++o)
+    {
+      // Invert the absolute value, so that the zero crossings become sharp ridges,
+      // and let each octave's contribution be damped where the previous ones were low.
+      Lanes signal = Lanes(1.0) - abs(gradientNoise(m_permutations[o].data(), X, Y, Z));
+      signal = signal * signal * weight;
+
+      weight = clamp01(signal * two);
+      value = value + signal * Lanes(m_spectralWeights[o]);
+
+      X = X * lacunarity;
+      Y = Y * lacunarity;
+      Z = Z * lacunarity;
+    }
+
+    value = value * Lanes(1.25) - Lanes(1.0);
+
+    if (partial)
+    {
+      value.store(pout);
+      std::copy(pout, pout + (n - k), out + k);
+    }
+    else
+    {
+      value.store(out + k);
+    }
+  }
+}
+
+const char * RidgedMultiNoise::simdName()
+{
+  return SIMD_NAME;
+}
@@ -0,0 +1,65 @@
+#ifndef H_GRADIENTNOISE
+#define H_GRADIENTNOISE
+
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/* A ridged multifractal over 3D gradient ("improved Perlin") noise.
+ *
+ * This is an in-tree replacement for libnoise's RidgedMulti module, selected at
+ * build time with the CMake option USE_INTREE_NOISE. It has the same parameters
+ * and the same (libnoise-style) setter names, so that NoiseGenerator can use
+ * either, but it does not reproduce libnoise's values: the same seed gives
+ * different terrain with the two engines.
+ *
+ * Unlike libnoise, it evaluates many points per call. GetValues() runs the whole
+ * octave stack on several points at once, using AVX (four doubles) or SSE2 (two
+ * doubles) if the compiler targets them, and plain doubles otherwise; all three
+ * paths give the same results up to rounding.
+ */
+
+class RidgedMultiNoise
+{
+public:
+  enum { maxOctaves = 16 };
+
+  RidgedMultiNoise();
+
+  void SetSeed(int seed);
+  void SetFrequency(double frequency);
+  void SetLacunarity(double lacunarity);
+  void SetOctaveCount(int octaves);
+
+  inline int    GetSeed()        const { return m_seed; }
+  inline double GetFrequency()   const { return m_frequency; }
+  inline double GetLacunarity()  const { return m_lacunarity; }
+  inline int    GetOctaveCount() const { return m_octaves; }
+
+  /// The noise value at one point, roughly in [-1, 1].
+  double GetValue(double x, double y, double z) const;
+
+  /// The noise values at n points, given by their coordinate arrays.
+  void GetValues(size_t n, const double * x, const double * y, const double * z, double * out) const;
+
+  /// The name of the instruction set used by GetValues().
+  static const char * simdName();
+
+private:
+  /// One hash permutation per octave, doubled up so that lookups never need to wrap.
+  typedef std::array<uint8_t, 512> Permutation;
+
+  void update();
+
+  int                      m_seed;
+  double                   m_frequency;
+  double                   m_lacunarity;
+  int                      m_octaves;
+  std::vector<Permutation> m_permutations;
+  std::vector<double>      m_spectralWeights;
+};
+
+
+#endif
@@ -2,199 +2,98 @@
 #define H_INPUTHELPER
 
 
-#include <list>
 #include <deque>
 #include <vector>
 #include <string>
 #include <algorithm>
 
 #include "syncqueue.h"
+#include "packetschema.h"
+#include "utf16.h"
 
 
 
-typedef struct _twobytestring_t
-{
-  unsigned char byte1;
-  unsigned char byte2;
-} twobytestring_t;
+/* Variable-length packets are measured in the queue by a LengthProbe, which only peeks
+ * at the length fields, and are then extracted in one go and decoded by a PacketReader.
+ * Fixed-size packets are decoded with their schemas (see packetschema.h).
+ */
 
-typedef union t_codepoint_tmp
+/// Converts n UTF-16BE code units to UTF-8.
+static inline std::string stringFromUTF16BE(const unsigned char * p, size_t n)
 {
-  char c[7];
-  unsigned char u[7];
-} t_codepoint;
+  std::string s;
+  appendUTF8FromUTF16BE(s, p, n);
+  return s;
+}
 
-/** Creates a UTF-8 representation of a single unicode codepoint.
- *  Implements the Prosser-Thompson scheme, szOut.c is always null-terminated.
+/* Walks the fields of the packet at offset start in a queue without removing anything.
+ * Each step returns false if the queue ends before the field; need() is then a lower
+ * bound for the length of the packet, and the exact length once all steps succeeded.
+ * The queue must not change while it is being probed.
  */
-void codepointToUTF8(unsigned int cp, t_codepoint * szOut)
-{
-  std::fill(szOut->u, szOut->u + 7, 0);
-
-  // We don't need this. It's just for information.
-  /*
-  if      (cp < 0x00000080) len = 1;
-  else if (cp < 0x00000800) len = 2;
-  else if (cp < 0x00010000) len = 3;
-  else if (cp < 0x04000000) len = 4;
-  else if (cp < 0x80000000) len = 5;
-  else                      len = 6;
-  */
 
-  size_t i = 0;
+class LengthProbe
+{
+public:
+  LengthProbe(const std::deque<unsigned char> & q, size_t start) : m_q(q), m_start(start), m_end(start + 1) { } // the type byte
 
-  if (cp < 0x80) szOut->u[i] = cp & 0x7F;
+  inline size_t need() const { return m_end - m_start; }
 
-  else if (cp < 0x800)
-  {
-    szOut->u[i++] = 0xc0 | (cp >> 6);
-    szOut->u[i++] = 0x80 | (cp & 0x3F);
-  }
-
-  else if (cp < 0x10000)
-  {
-    szOut->u[i++] = 0xE0 | ( cp >> 12         );
-    szOut->u[i++] = 0x80 | ((cp >>  6) & 0x3F );
-    szOut->u[i++] = 0x80 | ( cp        & 0x3F );
-  }
+  inline bool skip(size_t n) { m_end += n; return m_end <= m_q.size(); }
 
-  else if (cp < 0x4000000)
+  inline bool int16(int16_t & x)
   {
-    szOut->u[i++] = 0xF0 | ( cp >> 18         );
-    szOut->u[i++] = 0x80 | ((cp >> 12) & 0x3F );
-    szOut->u[i++] = 0x80 | ((cp >>  6) & 0x3F );
-    szOut->u[i++] = 0x80 | ( cp        & 0x3F );
+    if (!skip(2)) return false;
+    x = int16_t(uint16_t(m_q[m_end - 2]) << 8 | m_q[m_end - 1]);
+    return true;
   }
 
-  else if (cp < 0x80000000)
+  inline bool int32(int32_t & x)
   {
-    szOut->u[i++] = 0xF8 | ( cp >> 24         );
-    szOut->u[i++] = 0x80 | ((cp >> 18) & 0x3F );
-    szOut->u[i++] = 0x80 | ((cp >> 12) & 0x3F );
-    szOut->u[i++] = 0x80 | ((cp >>  6) & 0x3F );
-    szOut->u[i++] = 0x80 | ( cp        & 0x3F );
+    if (!skip(4)) return false;
+    x = int32_t(uint32_t(m_q[m_end - 4]) << 24 | uint32_t(m_q[m_end - 3]) << 16 | uint32_t(m_q[m_end - 2]) << 8 | m_q[m_end - 1]);
+    return true;
   }
 
-  else
+  /// A string: its length in UTF-16 code units, then the code units.
+  inline bool string()
   {
-    szOut->u[i++] = 0xFC | ( cp >> 30         );
-    szOut->u[i++] = 0x80 | ((cp >> 24) & 0x3F );
-    szOut->u[i++] = 0x80 | ((cp >> 18) & 0x3F );
-    szOut->u[i++] = 0x80 | ((cp >> 12) & 0x3F );
-    szOut->u[i++] = 0x80 | ((cp >>  6) & 0x3F );
-    szOut->u[i++] = 0x80 | ( cp        & 0x3F );
+    int16_t n;
+    return int16(n) && skip(2 * std::max(int(n), 0));
   }
-}
-
 
+private:
+  const std::deque<unsigned char> & m_q;
+  const size_t m_start;
+  size_t m_end;
+};
 
-/* The #defines are for reading from a std::vector,
- *  the read*() functions are for reversible reading from the deque.
- */
-
-#define READ_INT8(data, i)   ((unsigned int)(data[i]))
-#define READ_INT16(data, i)  (int)((unsigned int)(data[i+1]) | ((unsigned int)(data[i]) << 8))
-#define READ_INT32(data, i)  (int)((unsigned int)(data[i+3]) | (unsigned int)(data[i+2]) << 8 | (unsigned int)(data[i+1]) << 16 | ((unsigned int)(data[i]) << 24))
-#define READ_BOOL(data, i)   (data[i] != 0)
-#define READ_ANGLEFROMBYTE(data, i)   (double(data[i]) / 256. * 360.)
+/// Reads the fields of a complete packet from a contiguous buffer, one after the other.
 
-static inline double READ_DOUBLE(const std::vector<unsigned char> & data, size_t i)
+class PacketReader
 {
-  double y;
-  char * c = reinterpret_cast<char*>(&y);
-  c[7] = data[i]; c[6] = data[i+1]; c[5] = data[i+2]; c[4] = data[i+3]; c[3] = data[i+4]; c[2] = data[i+5]; c[1] = data[i+6]; c[0] = data[i+7];
-  return y;
-}
+public:
+  explicit PacketReader(const unsigned char * p) : m_p(p) { }
 
-static inline float READ_FLOAT(const std::vector<unsigned char> & data, size_t i)
-{
-  float y;
-  char * c = reinterpret_cast<char*>(&y);
-  c[3] = data[i]; c[2] = data[i+1]; c[1] = data[i+2]; c[0] = data[i+3];
-  return y;
-}
-
-static inline int8_t readInt8(std::shared_ptr<SyncQueue> q, std::list<unsigned char> & journal)
-{
-  char c = q->pop_unsafe(); journal.push_back(c);
-  return c;
-}
-
-static inline int16_t readInt16(std::shared_ptr<SyncQueue> q, std::list<unsigned char> & journal)
-{
-  char c;
-  uint16_t r = 0;
-  c = q->pop_unsafe(); journal.push_back(c); r |= ((uint16_t)(unsigned char)(c) <<  8);
-  c = q->pop_unsafe(); journal.push_back(c); r |= ((uint16_t)(unsigned char)(c) <<  0);
-  return int16_t(r);
-}
-
-static inline int32_t readInt32(std::shared_ptr<SyncQueue> q, std::list<unsigned char> & journal)
-{
-  char c;
-  uint32_t r = 0;
-  c = q->pop_unsafe(); journal.push_back(c); r |= ((uint32_t)(unsigned char)(c) << 24);
-  c = q->pop_unsafe(); journal.push_back(c); r |= ((uint32_t)(unsigned char)(c) << 16);
-  c = q->pop_unsafe(); journal.push_back(c); r |= ((uint32_t)(unsigned char)(c) <<  8);
-  c = q->pop_unsafe(); journal.push_back(c); r |= ((uint32_t)(unsigned char)(c) <<  0);
-  return int32_t(r);
-}
-
-static inline int64_t readInt64(std::shared_ptr<SyncQueue> q, std::list<unsigned char> & journal)
-{
-  char c;
-  uint64_t r = 0;
-  c = q->pop_unsafe(); journal.push_back(c); r |= ((uint64_t)(unsigned char)(c) << 56);
-  c = q->pop_unsafe(); journal.push_back(c); r |= ((uint64_t)(unsigned char)(c) << 48);
-  c = q->pop_unsafe(); journal.push_back(c); r |= ((uint64_t)(unsigned char)(c) << 40);
-  c = q->pop_unsafe(); journal.push_back(c); r |= ((uint64_t)(unsigned char)(c) << 32);
-  c = q->pop_unsafe(); journal.push_back(c); r |= ((uint64_t)(unsigned char)(c) << 24);
-  c = q->pop_unsafe(); journal.push_back(c); r |= ((uint64_t)(unsigned char)(c) << 16);
-  c = q->pop_unsafe(); journal.push_back(c); r |= ((uint64_t)(unsigned char)(c) <<  8);
-  c = q->pop_unsafe(); journal.push_back(c); r |= ((uint64_t)(unsigned char)(c) <<  0);
-  return int64_t(r);
-}
-
-/// This does not actually convert the Java null-byte surrogate back to 0, it's just
-/// a function to deal with pre-1.5 strings (ordinary 8-bit strings, modified-UTF8-encoded).
-/// Since we use UTF8 internally, there's nothing to do.
-static inline std::string readJString(std::shared_ptr<SyncQueue> q, std::list<unsigned char> & journal, uint16_t len)
-{
-  std::string r(len, 0);
-  for (size_t i = 0; i < len; ++i)
+  template <typename T> inline T read()
   {
-    r[i] = q->pop_unsafe();
-    journal.push_back(r[i]);
+    const T x = FieldCodec<T>::read(m_p);
+    m_p += FieldCodec<T>::size;
+    return x;
   }
-  return r;
-}
-
-static inline std::string readString(std::shared_ptr<SyncQueue> q, std::list<unsigned char> & journal, uint16_t len)
-{
-  t_codepoint     ccp;
-  twobytestring_t cbuf;
-  std::string     s;
-  size_t          n = len;
 
-  while (n--)
+  /// Negative lengths are read as empty strings, like LengthProbe::string() measures them.
+  inline std::string string()
   {
-    cbuf.byte1 = q->pop_unsafe();
-    cbuf.byte2 = q->pop_unsafe();
-
-    journal.push_back(cbuf.byte1);
-    journal.push_back(cbuf.byte2);
-
-    codepointToUTF8(((unsigned int)(cbuf.byte1)<<8) | ((unsigned int)(cbuf.byte2)), &ccp);
-    s += std::string(ccp.c);
+    const size_t n = std::max(int(read<int16_t>()), 0);
+    const std::string s = stringFromUTF16BE(m_p, n);
+    m_p += 2 * n;
+    return s;
   }
 
-  return s;
-}
-
-static inline void rewindJournal(std::shared_ptr<SyncQueue> q, std::list<unsigned char> & journal)
-{
-  q->pushFrontUnsafe(journal.begin(), journal.end());
-}
+private:
+  const unsigned char * m_p;
+};
 
 
 #endif
@@ -1,333 +1,335 @@
 #include <iostream>
+#include <iomanip>
 #include "inputparser.h"
 #include "inputhelper.h"
+#include "packetschema.h"
 #include "constants.h"
 
 
-InputParser::InputParser(GameStateManager & gsm)
-  : m_gsm(gsm)
-{
-}
-
-void InputParser::immediateDispatch(int32_t eid, const std::vector<unsigned char> & data)
+namespace
 {
-  const char type = data[0];
+  /* The decoders of the fixed-size packets. The field layouts are in packetschema.h;
+   * the lambdas just put the fields in the handlers' order.
+   */
 
-  switch (type)
+  void decodeKeepAlive(GameStateManager & gsm, int32_t eid, const unsigned char * payload)
   {
-
-  case (PACKET_KEEP_ALIVE):
-  {
-    m_gsm.packetCSKeepAlive(eid);
-    break;
+    CSKeepAlive::decode(payload, [&]() { gsm.packetCSKeepAlive(eid); });
   }
 
-  case (PACKET_USE_ENTITY):
+  void decodeUseEntity(GameStateManager & gsm, int32_t eid, const unsigned char * payload)
   {
-    const int32_t e = READ_INT32(data, 1);
-    const int32_t target = READ_INT32(data, 5);
-    const bool leftclick = (data[9] != 0);
-    m_gsm.packetCSUseEntity(eid, e, target, leftclick);
-    break;
+    CSUseEntity::decode(payload, [&](int32_t e, int32_t target, bool leftclick)
+                        { gsm.packetCSUseEntity(eid, e, target, leftclick); });
   }
 
-  case (PACKET_PRE_CHUNK): // when received from the client, a request for a chunk?
+  // When received from the client, a request for a chunk?
+  void decodePreChunk(GameStateManager & gsm, int32_t eid, const unsigned char * payload)
   {
-    const int32_t X = READ_INT32(data, 1);
-    const int32_t Z = READ_INT32(data, 5);
-    const bool mode = (data[9] != 0);
-    m_gsm.packetCSChunkRequest(eid, X, Z, mode);
-    break;
+    CSPreChunk::decode(payload, [&](int32_t X, int32_t Z, bool mode)
+                       { gsm.packetCSChunkRequest(eid, X, Z, mode); });
   }
 
-  case (PACKET_PLAYER): // whether or not the player is on the ground
+  // Whether or not the player is on the ground.
+  void decodePlayer(GameStateManager & gsm, int32_t eid, const unsigned char * payload)
   {
-    const bool b = READ_BOOL(data, 1);
-    m_gsm.packetCSPlayer(eid, b);
-    break;
+    CSPlayer::decode(payload, [&](bool b) { gsm.packetCSPlayer(eid, b); });
   }
 
-  case (PACKET_PLAYER_POSITION):
+  void decodePlayerPosition(GameStateManager & gsm, int32_t eid, const unsigned char * payload)
   {
-    const double X = READ_DOUBLE(data, 1), Y = READ_DOUBLE(data, 9), Z = READ_DOUBLE(data, 25), stance = READ_DOUBLE(data, 17);
-    const bool b = READ_BOOL(data, 33);
-    m_gsm.packetCSPlayerPosition(eid, X, Y, Z, stance, b);
-    break;
+    CSPlayerPosition::decode(payload, [&](double X, double Y, double stance, double Z, bool b)
+                             { gsm.packetCSPlayerPosition(eid, X, Y, Z, stance, b); });
   }
 
-  case (PACKET_PLAYER_LOOK):
+  void decodePlayerLook(GameStateManager & gsm, int32_t eid, const unsigned char * payload)
   {
-    const float yaw = READ_FLOAT(data, 1), pitch = READ_FLOAT(data, 5);
-    const bool b = READ_BOOL(data, 9);
-    m_gsm.packetCSPlayerLook(eid, yaw, pitch, b);
-    break;
+    CSPlayerLook::decode(payload, [&](float yaw, float pitch, bool b)
+                         { gsm.packetCSPlayerLook(eid, yaw, pitch, b); });
   }
 
-  case (PACKET_PLAYER_POSITION_AND_LOOK):
+  void decodePlayerPositionAndLook(GameStateManager & gsm, int32_t eid, const unsigned char * payload)
   {
-    const double X = READ_DOUBLE(data, 1), Y = READ_DOUBLE(data, 17), Z = READ_DOUBLE(data, 25), stance = READ_DOUBLE(data, 9);
-    const float yaw = READ_FLOAT(data, 33), pitch = READ_FLOAT(data, 37);
-    const bool b = READ_BOOL(data, 41);
-    m_gsm.packetCSPlayerPositionAndLook(eid, X, Y, Z, stance, yaw, pitch, b);
-    break;
+    CSPlayerPositionAndLook::decode(payload, [&](double X, double stance, double Y, double Z, float yaw, float pitch, bool b)
+                                    { gsm.packetCSPlayerPositionAndLook(eid, X, Y, Z, stance, yaw, pitch, b); });
   }
 
-  case (PACKET_PLAYER_DIGGING):
+  void decodePlayerDigging(GameStateManager & gsm, int32_t eid, const unsigned char * payload)
   {
-    const uint8_t status = READ_INT8(data, 1), Y = READ_INT8(data, 6), face = READ_INT8(data, 11);
-    const int32_t X = READ_INT32(data, 2), Z = READ_INT32(data, 7);
-    m_gsm.packetCSPlayerDigging(eid, X, Y, Z, status, face);
-    break;
+    CSPlayerDigging::decode(payload, [&](uint8_t status, int32_t X, uint8_t Y, int32_t Z, uint8_t face)
+                            { gsm.packetCSPlayerDigging(eid, X, Y, Z, status, face); });
   }
 
-  case (PACKET_HOLDING_CHANGE):
+  void decodeHoldingChange(GameStateManager & gsm, int32_t eid, const unsigned char * payload)
   {
-    const int16_t slot = READ_INT16(data, 1);
-    m_gsm.packetCSHoldingChange(eid, slot);
-    break;
+    CSHoldingChange::decode(payload, [&](int16_t slot) { gsm.packetCSHoldingChange(eid, slot); });
   }
 
-  case (PACKET_ARM_ANIMATION):
+  void decodeArmAnimation(GameStateManager & gsm, int32_t eid, const unsigned char * payload)
   {
-    const int32_t e = READ_INT32(data, 1);
-    const int8_t animate = READ_INT8(data, 5);
-    m_gsm.packetCSArmAnimation(eid, e, animate);
-    break;
+    CSArmAnimation::decode(payload, [&](int32_t e, int8_t animate) { gsm.packetCSArmAnimation(eid, e, animate); });
   }
 
-  case (PACKET_ENTITY_CROUCH):
+  // 1 = crouch, 2 = uncrouch, 3 = leave bed
+  void decodeEntityCrouch(GameStateManager & gsm, int32_t eid, const unsigned char * payload)
   {
-    const int32_t e = READ_INT32(data, 1);
-    const int8_t action = READ_INT8(data, 5);     // 1 = crouch, 2 = uncrouch, 3 = leave bed
-    m_gsm.packetCSEntityCrouchBed(eid, e, action);
-    break;
+    CSEntityCrouch::decode(payload, [&](int32_t e, int8_t action) { gsm.packetCSEntityCrouchBed(eid, e, action); });
   }
 
-  case (PACKET_PICKUP_SPAWN):
+  void decodePickupSpawn(GameStateManager & gsm, int32_t eid, const unsigned char * payload)
   {
-    const int32_t e = READ_INT32(data, 1), X = READ_INT32(data, 10), Y = READ_INT32(data, 14), Z = READ_INT32(data, 18);
-    const int16_t item = READ_INT16(data, 5), sdata = READ_INT16(data, 8);
-    const int8_t count = READ_INT8(data, 7) /* , rotp = READ_INT8(data, 22), pitchp = READ_INT8(data, 23), rollp = READ_INT8(data, 24) */;
-    const double rot = READ_ANGLEFROMBYTE(data, 22), pitch = READ_ANGLEFROMBYTE(data, 23), roll = READ_ANGLEFROMBYTE(data, 24);
-    m_gsm.packetCSPickupSpawn(eid, e, X, Y, Z, rot, pitch, roll, count, item, sdata);
-    break;
+    CSPickupSpawn::decode(payload, [&](int32_t e, int16_t item, int8_t count, int16_t sdata, int32_t X, int32_t Y, int32_t Z, double rot, double pitch, double roll)
+                          { gsm.packetCSPickupSpawn(eid, e, X, Y, Z, rot, pitch, roll, count, item, sdata); });
   }
 
-  case (PACKET_RESPAWN):
+  void decodeRespawn(GameStateManager & gsm, int32_t eid, const unsigned char * payload)
   {
-    m_gsm.packetCSRespawn(eid);
-    break;
+    CSRespawn::decode(payload, [&]() { gsm.packetCSRespawn(eid); });
   }
 
-  case (PACKET_INVENTORY_CLOSE):
+  void decodeInventoryClose(GameStateManager & gsm, int32_t eid, const unsigned char * payload)
   {
-    const int8_t window_id = READ_INT8(data, 1);
-    m_gsm.packetCSCloseWindow(eid, window_id);
-    break;
+    CSInventoryClose::decode(payload, [&](int8_t window_id) { gsm.packetCSCloseWindow(eid, window_id); });
   }
 
-  case (PACKET_TRANSACTION):
+  void decodeTransaction(GameStateManager &, int32_t eid, const unsigned char *)
   {
-    /*
-    const int8_t window_id = READ_INT8(data, 1);
-    const int16_t action_number = READ_INT16(data, 2);
-    const bool accepted = READ_BOOL(data, 4);
-    */
-    
-    /* We may ignore this client packet. */
+    /* We may ignore this client packet (window, action number, accepted). */
     std::cout << "Transaction packet received from #" << eid << ", consider implementing." << std::endl;
-    break;
   }
 
-  default:
-    std::cerr << "Unknown fixed-width data field: Type " << (unsigned int)(type) << ", length " << data.size() << std::endl;
+
+  /* The decoders of the variable-length packets, which have been measured by measurePacket(). */
+
+  void decodeLoginRequest(GameStateManager & gsm, int32_t eid, const unsigned char * payload)
+  {
+    PacketReader r(payload);
+
+    const int32_t     protocol_version = r.read<int32_t>();
+    const std::string username         = r.string();
+    const std::string password         = protocol_version < 0x0B ? r.string() : "[NOT SENT]";
+    const int64_t     map_seed         = r.read<int64_t>();
+    const int8_t      dimension        = r.read<int8_t>();
+
+    gsm.packetCSLoginRequest(eid, protocol_version, username, password, map_seed, dimension);
   }
-}
 
-#define GUARDLOCK  std::lock_guard<SyncQueue> lock(*queue)
+  void decodeHandshake(GameStateManager & gsm, int32_t eid, const unsigned char * payload)
+  {
+    gsm.packetCSHandshake(eid, PacketReader(payload).string());
+  }
 
-bool InputParser::dispatchIfEnoughData(int32_t eid, std::shared_ptr<SyncQueue> queue)
-{
-  const unsigned int type = (unsigned int)(queue->front());
-  std::list<unsigned char> tmp;
+  void decodeChatMessage(GameStateManager & gsm, int32_t eid, const unsigned char * payload)
+  {
+    gsm.packetCSChatMessage(eid, PacketReader(payload).string());
+  }
 
-  switch (type)
+  void decodeDisconnect(GameStateManager & gsm, int32_t eid, const unsigned char * payload)
   {
+    gsm.packetCSDisconnect(eid, PacketReader(payload).string());
+  }
 
-  case (PACKET_LOGIN_REQUEST):
+  void decodeBlockPlacement(GameStateManager & gsm, int32_t eid, const unsigned char * payload)
   {
-    if (queue->size() < 7) return false;
+    PacketReader r(payload);
 
-    int32_t     protocol_version;
-    int16_t     username_len;
-    std::string username;
-    int16_t     password_len;
-    std::string password;
-    int64_t     map_seed;
-    int8_t      dimension;
+    const int32_t X         = r.read<int32_t>();
+    const int8_t  Y         = r.read<int8_t>();
+    const int32_t Z         = r.read<int32_t>();
+    const int8_t  direction = r.read<int8_t>();
+    const int16_t block_id  = r.read<int16_t>();
 
+    int8_t amount = 0;
+    int16_t damage = 0;
+    if (block_id >= 0)
     {
-      GUARDLOCK;
+      amount = r.read<int8_t>();
+      damage = r.read<int16_t>();
+    }
 
-      readInt8(queue, tmp);
+    gsm.packetCSBlockPlacement(eid, X, Y, Z, direction, block_id, amount, damage);
+  }
 
-      protocol_version = readInt32(queue, tmp);
+  void decodeInventoryChange(GameStateManager & gsm, int32_t eid, const unsigned char * payload)
+  {
+    PacketReader r(payload);
 
-      username_len     = readInt16(queue, tmp);
-      if (int(queue->size()) < 2 * username_len) { rewindJournal(queue, tmp); break; }
-      username         = readString(queue, tmp, username_len);
+    const int8_t  window_id   = r.read<int8_t>();
+    const int16_t slot        = r.read<int16_t>();
+    const int8_t  right_click = r.read<int8_t>();
+    const int16_t action      = r.read<int16_t>();
+    const int16_t item_id     = r.read<int16_t>();
 
-      /// As of 1.5, the password doesn't seem to get sent, at least when we send "-". ///
+    int8_t item_count = 0;
+    int16_t item_uses = 0;
+    if (item_id != -1)
+    {
+      item_count = r.read<int8_t>();
+      item_uses  = r.read<int16_t>();
+    }
 
-      if (protocol_version < 0x0B)
-      {
-        password_len     = readInt16(queue, tmp);
-        if (int(queue->size()) < 2 * password_len) { rewindJournal(queue, tmp); break; }
-        password         = readString(queue, tmp, password_len);
-      }
-      else
-      {
-        password = "[NOT SENT]";
-      }
+    gsm.packetCSWindowClick(eid, window_id, slot, right_click, action, item_id, item_count, item_uses);
+  }
 
-      if (int(queue->size()) < 9) { rewindJournal(queue, tmp); break; }
-      map_seed         = readInt64(queue, tmp);
+  void decodeSign(GameStateManager & gsm, int32_t eid, const unsigned char * payload)
+  {
+    PacketReader r(payload);
 
-      dimension        = readInt8(queue, tmp);
-    }
+    const int32_t X = r.read<int32_t>();
+    const int16_t Y = r.read<int16_t>();
+    const int32_t Z = r.read<int32_t>();
 
-    m_gsm.packetCSLoginRequest(eid, protocol_version, username, password, map_seed, dimension);
+    const std::string line1 = r.string();
+    const std::string line2 = r.string();
+    const std::string line3 = r.string();
+    const std::string line4 = r.string();
 
-    return true;
+    gsm.packetCSSign(eid, X, Y, Z, line1, line2, line3, line4);
   }
 
-  case (PACKET_HANDSHAKE):
-  case (PACKET_CHAT_MESSAGE):
-  case (PACKET_DISCONNECT):
+  /// The length of the variable-length packet at offset start in the queue, or a lower bound if it isn't all there yet.
+  size_t measurePacket(const std::deque<unsigned char> & q, size_t start)
   {
-    if (queue->size() < 3) return false;
-
-    int16_t str_len;
-    std::string str;
+    LengthProbe m(q, start);
+    int16_t i16;
+    int32_t i32;
 
+    switch (q[start])
     {
-      GUARDLOCK;
-
-      readInt8(queue, tmp);
-      str_len = readInt16(queue, tmp);
-      if (int(queue->size()) < 2 * str_len) { rewindJournal(queue, tmp); break; }
-      str = readString(queue, tmp, str_len);
+    case (PACKET_LOGIN_REQUEST):
+      // As of 1.5, the password doesn't seem to get sent, at least when we send "-".
+      m.int32(i32) && m.string() && (i32 >= 0x0B || m.string()) && m.skip(8 + 1);
+      break;
+
+    case (PACKET_HANDSHAKE):
+    case (PACKET_CHAT_MESSAGE):
+    case (PACKET_DISCONNECT):
+      m.string();
+      break;
+
+    case (PACKET_PLAYER_BLOCK_PLACEMENT):
+      m.skip(4 + 1 + 4 + 1) && m.int16(i16) && (i16 < 0 || m.skip(1 + 2));
+      break;
+
+    case (PACKET_INVENTORY_CHANGE):
+      m.skip(1 + 2 + 1 + 2) && m.int16(i16) && (i16 == -1 || m.skip(1 + 2));
+      break;
+
+    case (PACKET_SIGN):
+      m.skip(4 + 2 + 4) && m.string() && m.string() && m.string() && m.string();
+      break;
     }
 
-    switch (type)
-    {
-    case (PACKET_HANDSHAKE):    { m_gsm.packetCSHandshake(eid, str); return true; }
-    case (PACKET_CHAT_MESSAGE): { m_gsm.packetCSChatMessage(eid, str); return true; }
-    case (PACKET_DISCONNECT):   { m_gsm.packetCSDisconnect(eid, str); return true; }
-    }   
-
-    break;
+    return m.need();
   }
 
-  case (PACKET_PLAYER_BLOCK_PLACEMENT):
-  {
-    if (queue->size() < 13) return false;
 
-    int32_t X, Z;
-    int8_t Y, direction, amount = 0;
-    int16_t block_id, damage = 0;
+  /// The table entry of each packet type; anything not listed here does not exist.
 
-    {
-      GUARDLOCK;
-
-      readInt8(queue, tmp);
-      X = readInt32(queue, tmp);
-      Y = readInt8 (queue, tmp);
-      Z = readInt32(queue, tmp);
-      direction = readInt8(queue, tmp);
-      block_id = readInt16(queue, tmp);
-      if (block_id >= 0)
-      {
-        if (queue->size() < 16) { rewindJournal(queue, tmp); break; }
-        amount = readInt8(queue, tmp);
-        damage = readInt16(queue, tmp);
-      }
-    }
+  template <size_t Type> struct HandlerFor
+  {
+    static constexpr PacketHandler value() { return PacketHandler{ PACKET_DOES_NOT_EXIST, nullptr }; }
+  };
 
-    m_gsm.packetCSBlockPlacement(eid, X, Y, Z, direction, block_id, amount, damage);
+  template <typename Schema, PacketHandler::Decoder Decode> struct FixedHandler
+  {
+    static constexpr PacketHandler value() { return PacketHandler{ Schema::size, Decode }; }
+  };
 
-    return true;
+  template <PacketHandler::Decoder Decode> struct VariableHandler
+  {
+    static constexpr PacketHandler value() { return PacketHandler{ PACKET_VARIABLE_LEN, Decode }; }
+  };
+
+  template <> struct HandlerFor<PACKET_KEEP_ALIVE>               : FixedHandler<CSKeepAlive, &decodeKeepAlive> { };
+  template <> struct HandlerFor<PACKET_LOGIN_REQUEST>            : VariableHandler<&decodeLoginRequest> { };
+  template <> struct HandlerFor<PACKET_HANDSHAKE>                : VariableHandler<&decodeHandshake> { };
+  template <> struct HandlerFor<PACKET_CHAT_MESSAGE>             : VariableHandler<&decodeChatMessage> { };
+  template <> struct HandlerFor<PACKET_USE_ENTITY>               : FixedHandler<CSUseEntity, &decodeUseEntity> { };
+  template <> struct HandlerFor<PACKET_RESPAWN>                  : FixedHandler<CSRespawn, &decodeRespawn> { };
+  template <> struct HandlerFor<PACKET_PLAYER>                   : FixedHandler<CSPlayer, &decodePlayer> { };
+  template <> struct HandlerFor<PACKET_PLAYER_POSITION>          : FixedHandler<CSPlayerPosition, &decodePlayerPosition> { };
+  template <> struct HandlerFor<PACKET_PLAYER_LOOK>              : FixedHandler<CSPlayerLook, &decodePlayerLook> { };
+  template <> struct HandlerFor<PACKET_PLAYER_POSITION_AND_LOOK> : FixedHandler<CSPlayerPositionAndLook, &decodePlayerPositionAndLook> { };
+  template <> struct HandlerFor<PACKET_PLAYER_DIGGING>           : FixedHandler<CSPlayerDigging, &decodePlayerDigging> { };
+  template <> struct HandlerFor<PACKET_PLAYER_BLOCK_PLACEMENT>   : VariableHandler<&decodeBlockPlacement> { };
+  template <> struct HandlerFor<PACKET_HOLDING_CHANGE>           : FixedHandler<CSHoldingChange, &decodeHoldingChange> { };
+  template <> struct HandlerFor<PACKET_ARM_ANIMATION>            : FixedHandler<CSArmAnimation, &decodeArmAnimation> { };
+  template <> struct HandlerFor<PACKET_ENTITY_CROUCH>            : FixedHandler<CSEntityCrouch, &decodeEntityCrouch> { };
+  template <> struct HandlerFor<PACKET_PICKUP_SPAWN>             : FixedHandler<CSPickupSpawn, &decodePickupSpawn> { };
+  template <> struct HandlerFor<PACKET_PRE_CHUNK>                : FixedHandler<CSPreChunk, &decodePreChunk> { };
+  template <> struct HandlerFor<PACKET_INVENTORY_CLOSE>          : FixedHandler<CSInventoryClose, &decodeInventoryClose> { };
+  template <> struct HandlerFor<PACKET_INVENTORY_CHANGE>         : VariableHandler<&decodeInventoryChange> { };
+  template <> struct HandlerFor<PACKET_TRANSACTION>              : FixedHandler<CSTransaction, &decodeTransaction> { };
+  template <> struct HandlerFor<PACKET_SIGN>                     : VariableHandler<&decodeSign> { };
+  template <> struct HandlerFor<PACKET_DISCONNECT>               : VariableHandler<&decodeDisconnect> { };
+
+  template <size_t... I> constexpr std::array<PacketHandler, 256> makePacketHandlers(Indices<I...>)
+  {
+    return std::array<PacketHandler, 256>{{ HandlerFor<I>::value()... }};
   }
+}
 
-  case (PACKET_INVENTORY_CHANGE):
-  {
-    if (queue->size() < 9) return false;
+constexpr std::array<PacketHandler, 256> PACKET_HANDLERS = makePacketHandlers(MakeIndices<256>::type());
 
-    int8_t window_id, right_click, item_count = 0;
-    int16_t slot, action, item_id, item_uses = 0;
 
-    {
-      GUARDLOCK;
-
-      readInt8(queue, tmp);
-      window_id = readInt8(queue, tmp);
-      slot = readInt16(queue, tmp);
-      right_click = readInt8(queue, tmp);
-      action = readInt16(queue, tmp);
-      item_id = readInt16(queue, tmp);
-      if (item_id != -1)
-      {
-        if (queue->size() < 3) { rewindJournal(queue, tmp); break; }
-        item_count = readInt8(queue, tmp);
-        item_uses = readInt16(queue, tmp);
-      }
-    }
+InputParser::InputParser(GameStateManager & gsm)
+  :
+  m_gsm(gsm),
+  m_batch()
+{
+}
 
-    m_gsm.packetCSWindowClick(eid, window_id, slot, right_click, action, item_id, item_count, item_uses);
+bool InputParser::extractBatch(int32_t eid, SyncQueue & queue)
+{
+  m_batch.data.clear();
+  m_batch.packets.clear();
 
-    return true;
-  }
+  std::lock_guard<SyncQueue> lock(queue);
 
-  case (PACKET_SIGN):
+  const std::deque<unsigned char> & q = queue.q();
+
+  // Walk the packets in place; pos is where the next one starts, len the length of the last one looked at.
+  size_t pos = 0, len = 0;
+  bool garbage = false;
+
+  while (pos < q.size())
   {
-    if (queue->size() < 13) return false;
+    const PacketHandler & handler = PACKET_HANDLERS[q[pos]];
 
-    int32_t X, Z;
-    int16_t Y, len1, len2, len3, len4;
-    std::string line1, line2, line3, line4;
-    
+    if (handler.size == PACKET_DOES_NOT_EXIST)
     {
-      GUARDLOCK;
+      std::cout << "[Packet ID unkown] Unintellegible data! Clearing buffer for client #" << std::dec << eid << ". First byte was "
+                << std::setw(2) << std::setfill('0') << std::hex << (unsigned int)(q[pos]) << std::dec << std::endl;
+      garbage = true;
+      break;
+    }
 
-      readInt8(queue, tmp);
-      X = readInt32(queue, tmp);
-      Y = readInt16(queue, tmp);
-      Z = readInt32(queue, tmp);
+    len = handler.size >= 0 ? size_t(handler.size) + 1 : measurePacket(q, pos);
 
-      len1 = readInt16(queue, tmp);
-      if (int(queue->size()) < 2 * len1) { rewindJournal(queue, tmp); break; }
-      line1 = readString(queue, tmp, len1);
+    if (pos + len > q.size()) break;
 
-      len2 = readInt16(queue, tmp);
-      if (int(queue->size()) < 2 * len2) { rewindJournal(queue, tmp); break; }
-      line2 = readString(queue, tmp, len2);
+    m_batch.packets.push_back(std::make_pair(handler.decode, pos + 1));
+    pos += len;
+  }
 
-      len3 = readInt16(queue, tmp);
-      if (int(queue->size()) < 2 * len3) { rewindJournal(queue, tmp); break; }
-      line3 = readString(queue, tmp, len3);
+  m_batch.data.resize(pos);
+  queue.pop(m_batch.data.data(), pos);
 
-      len4 = readInt16(queue, tmp);
-      if (int(queue->size()) < 2 * len4) { rewindJournal(queue, tmp); break; }
-      line4 = readString(queue, tmp, len4);
-    }
+  if (garbage) queue.clear();
 
-    m_gsm.packetCSSign(eid, X, Y, Z, line1, line2, line3, line4);
+  // Whatever is left is the beginning of a packet of (at least) len bytes.
+  queue.setWanted(queue.empty() ? 0 : len);
 
-    return true;
-  }
+  return !m_batch.packets.empty();
+}
 
-  default:
-    std::cerr << "Unknown variable-width data field: Type " << (unsigned int)(type) << std::endl;
+void InputParser::dispatchBatch(int32_t eid)
+{
+  std::lock_guard<std::recursive_mutex> lock(m_gsm.stateMutex());
+
+  for (auto it = m_batch.packets.cbegin(); it != m_batch.packets.cend(); ++it)
+  {
+    it->first(m_gsm, eid, m_batch.data.data() + it->second);
   }
-  return false;
 }
@@ -2,21 +2,59 @@
 #define H_INPUTPARSER
 
 
+#include <array>
+#include <vector>
+#include <utility>
 #include "gamestatemanager.h"
 
+/* How to handle each packet type, indexed by the type byte: the payload size
+ * (without the type byte) of fixed-size packets, or PACKET_VARIABLE_LEN, and a
+ * decoder, which reads the fields of a complete packet from a contiguous buffer
+ * and calls the game state manager.
+ */
+
+struct PacketHandler
+{
+  typedef void (*Decoder)(GameStateManager & gsm, int32_t eid, const unsigned char * payload);
+
+  int size; // payload bytes, PACKET_VARIABLE_LEN or PACKET_DOES_NOT_EXIST
+  Decoder decode;
+};
+
+extern const std::array<PacketHandler, 256> PACKET_HANDLERS;
+
+
+/* The complete packets that were waiting for one client: the raw packets back
+ * to back, and the decoder and payload offset of each of them.
+ */
+
+struct IngressBatch
+{
+  IngressBatch() : data(), packets() { }
+
+  std::vector<unsigned char> data;
+  std::vector<std::pair<PacketHandler::Decoder, size_t>> packets;
+};
+
+
 class InputParser
 {
 public:
   InputParser(GameStateManager & gsm);
 
-  /// Processing incoming packets.
-  void immediateDispatch(int32_t eid, const std::vector<unsigned char> & data);
+  /// Takes all complete packets off the queue, in one pass and under one lock, into the batch.
+  /// An incomplete packet stays in the queue, whose wanted() count then says how much data it
+  /// needs at least. Unintelligible data is discarded. Returns true if there is anything to dispatch.
+  bool extractBatch(int32_t eid, SyncQueue & queue);
 
-  /// Return true if a whole packet was extracted.
-  bool dispatchIfEnoughData(int32_t eid, std::shared_ptr<SyncQueue> queue);
+  /// Hands the batch to the game state manager, under a single lock of the game state.
+  void dispatchBatch(int32_t eid);
 
 private:
   GameStateManager & m_gsm;
+
+  /// Kept between calls, to reuse its memory.
+  IngressBatch m_batch;
 };
 
 
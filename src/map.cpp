@@ -1,4 +1,9 @@
 #include <iostream>
+#include <cstdlib>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <mutex>
 
 #include "map.h"
 #include "generator.h"
@@ -11,25 +16,238 @@ Map::Map(unsigned long long int ticks, int seed)
   m_chunks(),
   m_items(),
   m_serializer(m_chunks, *this),
+  m_generators(),
+  m_requests(),
+  m_idle(),
   m_seed(seed)
 {
 }
 
 void Map::ensureChunkIsLoaded(const ChunkCoords & cc)
 {
-  if (m_chunks.count(cc) == 0)
+  if (m_chunks.find(cc) != NULL) return;
+
+  // The chunk is only published once it is complete, so this may run on any thread.
+  m_chunks.getOrCreate(cc, [this, &cc]() -> ChunkMap::mapped_type
   {
     if (m_serializer.haveChunk(cc) == true)
     {
-      m_chunks.insert(ChunkMap::value_type(cc, m_serializer.loadChunk(cc))).first;
+      return m_serializer.loadChunk(cc);
     }
     else
     {
       std::cout << "** generating chunk **" << std::endl;
-      auto ins = m_chunks.insert(ChunkMap::value_type(cc, std::make_shared<Chunk>(cc))).first;
-      generateWithNoise(*ins->second, cc);
+      auto chunk = std::make_shared<Chunk>(cc);
+      generateWithNoise(*chunk, cc);
+      return chunk;
+    }
+  });
+}
+
+void Map::ensureChunksAreLoaded(const std::vector<ChunkCoords> & ccs, const ChunkCoords & centre,
+                                const std::function<void(size_t, size_t)> & progress)
+{
+  typedef std::pair<ChunkCoords, std::shared_future<ChunkMap::mapped_type>> Job;
+  std::vector<Job> jobs;
+
+  // First hand out all the work, then collect the results. Chunks on disk are loaded directly.
+
+  if (m_generators)
+  {
+    for (auto it = ccs.cbegin(); it != ccs.cend(); ++it)
+    {
+      if (m_chunks.find(*it) != NULL || m_serializer.haveChunk(*it)) continue;
+
+      const unsigned int priority = std::abs(cX(*it) - cX(centre)) + std::abs(cZ(*it) - cZ(centre));
+      jobs.push_back(Job(*it, m_generators->submit(*it, priority)));
+    }
+  }
+
+  for (auto it = jobs.begin(); it != jobs.end(); ++it)
+  {
+    const std::shared_future<ChunkMap::mapped_type> & f = it->second;
+    m_chunks.getOrCreate(it->first, [&f]() { return f.get(); });
+
+    if (progress) progress(it - jobs.begin() + 1, jobs.size());
+  }
+
+  for (auto it = ccs.cbegin(); it != ccs.cend(); ++it)
+  {
+    ensureChunkIsLoaded(*it);
+  }
+}
+
+void Map::requestChunks(const std::unordered_map<ChunkCoords, unsigned int> & wanted)
+{
+  // Collect what has arrived, and call off what nobody needs any more.
+
+  for (auto it = m_requests.begin(); it != m_requests.end(); )
+  {
+    if (it->second.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    {
+      if (it->second.get()) m_chunks.insert(ChunkMap::value_type(it->first, it->second.get()));
+      it = m_requests.erase(it);
+    }
+    else if (wanted.count(it->first) == 0 && m_generators->cancel(it->first))
+    {
+      it = m_requests.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  // Submitting again only updates the priority of a job that is already queued.
+
+  for (auto it = wanted.cbegin(); it != wanted.cend(); ++it)
+  {
+    if (m_chunks.find(it->first) != NULL) continue;
+
+    if (!m_generators || m_serializer.haveChunk(it->first))
+    {
+      ensureChunkIsLoaded(it->first);
+      continue;
+    }
+
+    m_requests[it->first] = m_generators->submit(it->first, it->second);
+  }
+}
+
+namespace
+{
+  /// Run f(0), ..., f(n - 1) on a number of threads.
+  template <typename F> void parallelFor(size_t n, size_t threads, F f)
+  {
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> pool;
+
+    for (size_t t = 0; t < threads; ++t)
+      pool.push_back(std::thread([&next, n, &f]() { for (size_t i = next++; i < n; i = next++) f(i); }));
+
+    for (auto it = pool.begin(); it != pool.end(); ++it)
+      it->join();
+  }
+
+  inline long long int millisecondsSince(const std::chrono::steady_clock::time_point & start)
+  {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+  }
+}
+
+void Map::prepareChunks(const std::vector<ChunkCoords> & ccs, const ChunkCoords & centre)
+{
+  const size_t threads = m_generators ? m_generators->workers() : 1;
+
+  // 1. Terrain
+
+  auto start = std::chrono::steady_clock::now();
+  std::cout << "  Generating terrain... ";
+  std::cout.flush();
+
+  size_t percent = 0;
+  ensureChunksAreLoaded(ccs, centre, [&percent](size_t done, size_t total)
+  {
+    if (100 * done / total < percent + 10) return;
+    percent = 100 * done / total;
+    std::cout << percent << "% ";
+    std::cout.flush();
+  });
+
+  std::cout << "done (" << std::dec << millisecondsSince(start) << " ms)." << std::endl;
+
+  // 2. Light. Each chunk's own light is a local affair, but spreading crosses chunk borders.
+
+  start = std::chrono::steady_clock::now();
+  std::cout << "  Lighting... ";
+  std::cout.flush();
+
+  std::vector<Chunk *> fresh;
+  for (auto it = ccs.cbegin(); it != ccs.cend(); ++it)
+    if (!m_chunks.find(*it)->lit()) fresh.push_back(&chunk(*it));
+
+  parallelFor(fresh.size(), threads, [&fresh](size_t i) { fresh[i]->updateLightAndHeightMaps(); });
+
+  for (auto it = fresh.begin(); it != fresh.end(); ++it)
+    (*it)->spreadAllLight(*this);
+
+  std::cout << "done (" << std::dec << millisecondsSince(start) << " ms)." << std::endl;
+
+  // 3. Compression
+
+  start = std::chrono::steady_clock::now();
+  std::cout << "  Compressing... ";
+  std::cout.flush();
+
+  size_t bytes = 0;
+  std::mutex bytes_mutex;
+
+  parallelFor(ccs.size(), threads, [this, &ccs, &bytes, &bytes_mutex](size_t i)
+  {
+    const size_t n = m_chunks.find(ccs[i])->compressed()->size();
+    std::lock_guard<std::mutex> lock(bytes_mutex);
+    bytes += n;
+  });
+
+  std::cout << "done (" << std::dec << millisecondsSince(start) << " ms, " << bytes / 1024 << " KiB)." << std::endl;
+}
+
+void Map::startGenerators(size_t workers)
+{
+  std::cout << "Starting " << std::dec << workers << " terrain generator thread(s)." << std::endl;
+  m_generators = std::make_shared<GeneratorPool>(*pNG, workers);
+}
+
+size_t Map::freezeChunksExcept(const std::unordered_set<ChunkCoords> & keep)
+{
+  size_t n = 0;
+  const std::vector<ChunkMap::value_type> chunks = m_chunks.snapshot();
+  std::unordered_set<ChunkCoords> idle;
+
+  for (auto it = chunks.cbegin(); it != chunks.cend(); ++it)
+  {
+    if (it->second->cold() || keep.count(it->first) > 0) continue;
+
+    if (m_idle.count(it->first) == 0)
+    {
+      idle.insert(it->first);
+      continue;
     }
+
+    it->second->freeze();
+    ++n;
   }
+
+  m_idle.swap(idle);
+
+  return n;
+}
+
+size_t Map::coldChunkCount() const
+{
+  size_t n = 0;
+  const std::vector<ChunkMap::value_type> chunks = m_chunks.snapshot();
+  for (auto it = chunks.cbegin(); it != chunks.cend(); ++it)
+    if (it->second->cold()) ++n;
+  return n;
+}
+
+size_t Map::storageChunkCount() const
+{
+  size_t n = 0;
+  const std::vector<ChunkMap::value_type> chunks = m_chunks.snapshot();
+  for (auto it = chunks.cbegin(); it != chunks.cend(); ++it)
+    if (it->second->hasStorageBlocks()) ++n;
+  return n;
+}
+
+size_t Map::residentSize() const
+{
+  size_t n = 0;
+  const std::vector<ChunkMap::value_type> chunks = m_chunks.snapshot();
+  for (auto it = chunks.cbegin(); it != chunks.cend(); ++it)
+    n += it->second->residentSize();
+  return n;
 }
 
 void Map::addStorage(const WorldCoords & wc, uint8_t block_type)
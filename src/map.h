@@ -5,8 +5,11 @@
 #include <array>
 #include <vector>
 #include <memory>
+#include <functional>
+#include <future>
 #include <map>
 #include <unordered_map>
+#include <unordered_set>
 #include <boost/noncopyable.hpp>
 
 #include "chunk.h"
@@ -59,6 +62,7 @@ inline uint32_t GenerateInventoryUID() { return ++INVENTORY_UID_POOL; }
 
 class Server;
 class UI;
+class GeneratorPool;
 
 class Map
 {
@@ -81,12 +85,26 @@ public:
   typedef std::unordered_map<int32_t, int> ItemMap;
   typedef std::unordered_multimap<WorldCoords, BlockAlert> AlertMap;
 
-  inline bool haveChunk(const ChunkCoords & cc) const { return m_chunks.count(cc) > 0; }
+  inline bool haveChunk(const ChunkCoords & cc) const { return m_chunks.find(cc) != NULL; }
 
-  inline       Chunk & chunk(const ChunkCoords & cc)       { return *(m_chunks.find(cc)->second); }
-  inline const Chunk & chunk(const ChunkCoords & cc) const { return *(m_chunks.find(cc)->second); }
-  inline       Chunk & chunk(const WorldCoords & wc)       { return *(m_chunks.find(getChunkCoords(wc))->second); }
-  inline const Chunk & chunk(const WorldCoords & wc) const { return *(m_chunks.find(getChunkCoords(wc))->second); }
+  /// Frozen chunks are thawed on access, so the returned chunk is always hot. This includes
+  /// the const overloads: a const lookup may repack the chunk, though never change its content.
+  inline       Chunk & chunk(const ChunkCoords & cc)       { return hot(*m_chunks.find(cc)); }
+  inline const Chunk & chunk(const ChunkCoords & cc) const { return hot(*m_chunks.find(cc)); }
+  inline       Chunk & chunk(const WorldCoords & wc)       { return hot(*m_chunks.find(getChunkCoords(wc))); }
+  inline const Chunk & chunk(const WorldCoords & wc) const { return hot(*m_chunks.find(getChunkCoords(wc))); }
+
+  /// Freeze the hot chunks that are not contained in keep, and weren't at the previous call
+  /// either, so that chunks just passed by (or prefetched) are not repacked back and forth.
+  /// Returns the number of newly frozen chunks.
+  size_t freezeChunksExcept(const std::unordered_set<ChunkCoords> & keep);
+
+  /// Some statistics: total number of chunks, number of frozen chunks, number of chunks
+  /// with chests, furnaces or dispensers (from the block summaries), approximate memory use in bytes.
+  inline size_t chunkCount() const { return m_chunks.size(); }
+  size_t coldChunkCount() const;
+  size_t storageChunkCount() const;
+  size_t residentSize() const;
 
   inline const ItemMap  & items()       const { return m_items; }
   inline       ItemMap  & items()             { return m_items; }
@@ -100,13 +118,39 @@ public:
   /// If no chunk exists at cc, load from disk or create a random one if none exists.
   void ensureChunkIsLoaded(const ChunkCoords & cc);
 
-  /// Call this only when about to send to a client. Don't forget to call "spreadAllLight()" on all chunks after this call.
-  inline void ensureChunkIsReadyForImmediateUse(const ChunkCoords & cc)
+  /// Load or generate several chunks at once. Missing chunks are generated in parallel
+  /// if the generator pool is running, nearest to centre first (L1 distance).
+  /// If given, progress(done, total) is called whenever a generated chunk arrives.
+  void ensureChunksAreLoaded(const std::vector<ChunkCoords> & ccs, const ChunkCoords & centre,
+                             const std::function<void(size_t, size_t)> & progress = std::function<void(size_t, size_t)>());
+
+  /// Get chunks completely ready for sending ahead of time: load or generate, light and
+  /// compress them, in parallel where possible. Reports progress and timing on stdout.
+  void prepareChunks(const std::vector<ChunkCoords> & ccs, const ChunkCoords & centre);
+
+  /// Keep exactly the chunks in wanted (that aren't loaded yet) in the works, in order of the given
+  /// priorities (lowest first); this replaces the previous call's wishes. Generated chunks are picked
+  /// up on the next call, jobs that are no longer wanted are cancelled. Chunks on disk are loaded
+  /// directly, as is everything if the generator pool isn't running.
+  void requestChunks(const std::unordered_map<ChunkCoords, unsigned int> & wanted);
+
+  /// Start the terrain generator threads (this needs the global noise generator to exist).
+  void startGenerators(size_t workers);
+
+  /// Call this only when about to send to a client. Returns true if the chunk had to be lit;
+  /// don't forget to call "spreadAllLight()" on all such chunks after this call.
+  inline bool ensureChunkIsReadyForImmediateUse(const ChunkCoords & cc)
   {
     ensureChunkIsLoaded(cc);
+    if (m_chunks.find(cc)->lit()) return false;
+
     chunk(cc).updateLightAndHeightMaps();
+    return true;
   }
 
+  /// The chunk's deflated data, without thawing it.
+  inline std::shared_ptr<const std::string> compressedChunk(const ChunkCoords & cc) const { return m_chunks.find(cc)->compressed(); }
+
   inline void insertChunk(std::shared_ptr<Chunk> chunk) { m_chunks.insert(ChunkMap::value_type(chunk->coords(), chunk)); }
 
   inline bool hasItem(int32_t eid) const { return m_items.count(eid) > 0; }
@@ -120,18 +164,26 @@ public:
     return it == m_stridx.end() ? 0 : it->second;
   }
 
-  inline void save() { m_serializer.serialize(); }
+  inline void save(const std::string & basename = "/tmp/mymap") { m_serializer.serialize(basename); }
 
   inline void load(const std::string & basename) { m_serializer.deserialize(basename); }
 
   unsigned long long int tick_counter;
 
 private:
+  static inline Chunk & hot(Chunk & chunk) { if (chunk.cold()) chunk.thaw(); return chunk; }
+
   ChunkMap   m_chunks;
   ItemMap    m_items;
   AlertMap   m_block_alerts;
   Serializer m_serializer;
 
+  std::shared_ptr<GeneratorPool> m_generators;
+  std::unordered_map<ChunkCoords, std::shared_future<ChunkMap::mapped_type>> m_requests;
+
+  /// Hot chunks that were outside the keep set at the last freezeChunksExcept().
+  std::unordered_set<ChunkCoords> m_idle;
+
   int        m_seed;
 
   MapStorage m_storage;
@@ -70,6 +70,8 @@ int main(int argc, char * argv[])
 
   size_t counter = 0;
 
+  auto buffer = std::make_shared<Chunk::ChunkData>();
+
 
   /// Stage III: Loop over input files
 
@@ -125,7 +127,9 @@ int main(int argc, char * argv[])
 
           auto chunk = NBTExtract(reinterpret_cast<const unsigned char*>(raw.data()), raw.length(), cc);
 
-          boost::iostreams::write(zdat, reinterpret_cast<const char*>(chunk->data().data()), Chunk::sizeBlockType + Chunk::sizeBlockMetaData);
+          chunk->exportData(*buffer);
+
+          boost::iostreams::write(zdat, reinterpret_cast<const char*>(buffer->data()), Chunk::sizeBlockType + Chunk::sizeBlockMetaData);
           boost::iostreams::write(zidx, reinterpret_cast<const char*>(&cx), 4);
           boost::iostreams::write(zidx, reinterpret_cast<const char*>(&cz), 4);
           boost::iostreams::write(zidx, reinterpret_cast<const char*>(&counter), 4);
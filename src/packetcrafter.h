@@ -2,9 +2,11 @@
 #define H_PACKETCRAFTER
 
 
-#include <vector>
 #include <string>
+#include <cstring>
+#include "bufferpool.h"
 #include "constants.h"
+#include "utf16.h"
 
 
 /// This is now obsolete; strings are encoded as UTF16.
@@ -21,22 +23,34 @@ static inline void convertToJavaString(std::string & s)
   }
 }
 
-/// The new string converter. Evil hack, not real. Must use something better like iconv(). Only works for ASCII!
+/// Big-endian (network order) conversion; the compiler turns these into single byte-swap instructions.
 
-static inline uint16_t BE_UTF16FromChar(char c)
-{
-  return 0x0000 | ((unsigned int)(unsigned char)(c) & 0xFF);
-}
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+static inline uint16_t toBigEndian16(uint16_t i) { return i; }
+static inline uint32_t toBigEndian32(uint32_t i) { return i; }
+static inline uint64_t toBigEndian64(uint64_t i) { return i; }
+#else
+static inline uint16_t toBigEndian16(uint16_t i) { return __builtin_bswap16(i); }
+static inline uint32_t toBigEndian32(uint32_t i) { return __builtin_bswap32(i); }
+static inline uint64_t toBigEndian64(uint64_t i) { return __builtin_bswap64(i); }
+#endif
 
 
+/*  Class PacketCrafter: Builds one packet in a pooled buffer (see BufferPool).
+ *  craft() hands the buffer over, without copying, so that it can be moved
+ *  all the way into the egress queue; the crafter is empty afterwards.
+ */
+
 class PacketCrafter
 {
 public:
-  explicit PacketCrafter(uint8_t type = -1) : m_buffer(1, type) { m_buffer.reserve(512); }
+  explicit PacketCrafter(uint8_t type = -1) : m_buffer(BufferPool::acquire()) { m_buffer.push_back(char(type)); }
+
+  ~PacketCrafter() { BufferPool::release(std::move(m_buffer)); }
 
-  inline std::string craft() const { return std::string(m_buffer.begin(), m_buffer.end()); }
+  inline std::string craft() { std::string s; s.swap(m_buffer); return s; }
 
-  inline void setType(int8_t type) { m_buffer[0] = (unsigned char)(type); }
+  inline void setType(int8_t type) { m_buffer[0] = char(type); }
 
 
   inline void addBool(bool b)
@@ -46,66 +60,56 @@ public:
 
   inline void addInt8(uint8_t i)
   {
-    m_buffer.push_back(i);
+    m_buffer.push_back(char(i));
   }
 
   inline void addInt16(uint16_t i)
   {
-    unsigned char b2 = (i >> 8), b1 = (i & 0xFF);
-    m_buffer.push_back(b2);
-    m_buffer.push_back(b1);
+    i = toBigEndian16(i);
+    m_buffer.append(reinterpret_cast<const char *>(&i), sizeof i);
   }
 
   inline void addInt32(uint32_t i)
   {
-    unsigned char b4 = ((i >> 24) & 0xFF), b3 = ((i >> 16) & 0xFF), b2 = ((i >> 8) & 0xFF), b1 = (i & 0xFF);
-    m_buffer.push_back(b4);
-    m_buffer.push_back(b3);
-    m_buffer.push_back(b2);
-    m_buffer.push_back(b1);
+    i = toBigEndian32(i);
+    m_buffer.append(reinterpret_cast<const char *>(&i), sizeof i);
   }
 
   inline void addInt64(uint64_t i)
   {
-    unsigned char b8 = ((i >> 56) & 0xFF), b7 = ((i >> 48) & 0xFF), b6 = ((i >> 40) & 0xFF), b5 = ((i >> 32) & 0xFF),
-                  b4 = ((i >> 24) & 0xFF), b3 = ((i >> 16) & 0xFF), b2 = ((i >>  8) & 0xFF), b1 =  (i        & 0xFF);
-    m_buffer.push_back(b8);
-    m_buffer.push_back(b7);
-    m_buffer.push_back(b6);
-    m_buffer.push_back(b5);
-    m_buffer.push_back(b4);
-    m_buffer.push_back(b3);
-    m_buffer.push_back(b2);
-    m_buffer.push_back(b1);
+    i = toBigEndian64(i);
+    m_buffer.append(reinterpret_cast<const char *>(&i), sizeof i);
   }
 
   // This produces the old, pre 1.5 string.
   inline void addJString(const std::string & s)
   {
-    addInt16(s.length()); m_buffer.insert(m_buffer.end(), s.begin(), s.end());
+    addInt16(s.length()); m_buffer.append(s);
   }
   
+  /// Our strings are UTF-8; the protocol wants UTF-16BE, prefixed by the number of code units.
   inline void addString(const std::string & s)
   {
-    addInt16(s.length());
-    for (std::string::const_iterator it = s.begin(); it != s.end(); ++it)
-      addInt16(BE_UTF16FromChar(*it));
+    const size_t pos = m_buffer.size();
+    addInt16(0);
+    const uint16_t n = toBigEndian16(appendUTF16BEFromUTF8(m_buffer, s.data(), s.length()));
+    m_buffer.replace(pos, sizeof n, reinterpret_cast<const char *>(&n), sizeof n);
   }
   
-  inline void addByteArray(const char * data, size_t length) { m_buffer.insert(m_buffer.end(), data, data + length); }
+  inline void addByteArray(const char * data, size_t length) { m_buffer.append(data, length); }
 
   inline void addDouble(double x)
   {
-    unsigned char * c = reinterpret_cast<unsigned char*>(&x);
-    std::vector<unsigned char> rev(c, c + 8);
-    m_buffer.insert(m_buffer.end(), rev.rbegin(), rev.rend());
+    uint64_t i;
+    std::memcpy(&i, &x, sizeof i);
+    addInt64(i);
   }
 
   inline void addFloat(float x)
   {
-    unsigned char * c = reinterpret_cast<unsigned char*>(&x);
-    std::vector<unsigned char> rev(c, c + 4);
-    m_buffer.insert(m_buffer.end(), rev.rbegin(), rev.rend());
+    uint32_t i;
+    std::memcpy(&i, &x, sizeof i);
+    addInt32(i);
   }
 
   inline void addAngleAsByte(double angle)
@@ -115,7 +119,7 @@ public:
 
 
 private:
-  std::vector<unsigned char> m_buffer;
+  std::string m_buffer;
 };
 
 
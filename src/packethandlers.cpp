@@ -1,6 +1,7 @@
 #include <iostream>
 #include "gamestatemanager.h"
 #include "packetcrafter.h"
+#include "packetschema.h"
 #include "cmdlineoptions.h"
 #include "map.h"
 #include "filereader.h"
@@ -23,12 +24,15 @@ void GameStateManager::packetCSPlayerDigging(int32_t eid, int32_t X, uint8_t Y,
 
   if (m_states.find(eid) == m_states.end()) return;
 
+  // Y comes straight off the wire; there are no blocks above or below the world.
+  if (status != 4 && !inWorld(WorldCoords(X, Y, Z))) return;
+
   /*** Digging, aka "the left mouse button" ***
 
    We check have two states (apart from the third one): Start (0) and Stop (2).
 
    To determine the course of action, we look up the block type at the target (X,Y,Z)
-   in the property table BLOCK_DIG_PROPERTIES. We recognise three properties:
+   in the property table BLOCK_PROPERTIES. We recognise three properties:
 
    * LEFTCLICK_DIGGABLE:  Ordinary blocks that can be removed by finishing digging.
    * LEFTCLICK_REMOVABLE: Blocks that are immediately removed, like torches and wire.
@@ -48,7 +52,7 @@ void GameStateManager::packetCSPlayerDigging(int32_t eid, int32_t X, uint8_t Y,
     Chunk & chunk = m_map.chunk(wc);
     unsigned char block = chunk.blockType(getLocalCoords(wc));
 
-    const unsigned char block_properties = BLOCK_DIG_PROPERTIES[block];
+    const unsigned char block_properties = digProperties(block);
 
     if (block_properties & LEFTCLICK_DIGGABLE)
     {
@@ -58,7 +62,7 @@ void GameStateManager::packetCSPlayerDigging(int32_t eid, int32_t X, uint8_t Y,
     if (block_properties & LEFTCLICK_REMOVABLE)
     {
       sendToAll(MAKE_CALLBACK(packetSCBlockChange, wc, BLOCK_Air, 0));
-      chunk.blockType(getLocalCoords(wc)) = BLOCK_Air;
+      chunk.setBlockType(getLocalCoords(wc), BLOCK_Air);
       chunk.taint();
       reactToSuccessfulDig(wc, EBlockItem(block));
     }
@@ -75,7 +79,7 @@ void GameStateManager::packetCSPlayerDigging(int32_t eid, int32_t X, uint8_t Y,
     const WorldCoords wc(X, Y, Z);
     Chunk & chunk = m_map.chunk(wc);
     unsigned char block = chunk.blockType(getLocalCoords(wc));
-    const unsigned char block_properties = BLOCK_DIG_PROPERTIES[block];
+    const unsigned char block_properties = digProperties(block);
 
     if (block_properties & LEFTCLICK_DIGGABLE)
     {
@@ -85,7 +89,7 @@ void GameStateManager::packetCSPlayerDigging(int32_t eid, int32_t X, uint8_t Y,
                   << BLOCKITEM_INFO.find(EBlockItem(block))->second.name << "." << std::endl;
 
         sendToAll(MAKE_CALLBACK(packetSCBlockChange, wc, BLOCK_Air, 0));
-        chunk.blockType(getLocalCoords(wc)) = BLOCK_Air;
+        chunk.setBlockType(getLocalCoords(wc), BLOCK_Air);
         chunk.taint();
         makeItemsDrop(wc);
         reactToSuccessfulDig(wc, EBlockItem(block));
@@ -149,6 +153,8 @@ void GameStateManager::packetCSBlockPlacement(int32_t eid, int32_t X, int8_t Y,
   {
     WorldCoords wc(X, Y, Z);
 
+    if (!inWorld(wc)) return;
+
     if (!m_map.haveChunk(getChunkCoords(wc)))
     {
       std::cout << "Panic, right-click went into a non-existing chunk!" << std::endl;
@@ -193,7 +199,8 @@ void GameStateManager::packetCSBlockPlacement(int32_t eid, int32_t X, int8_t Y,
     {
       wc += Direction(direction);
 
-      if (!m_map.haveChunk(getChunkCoords(wc))) return;
+      // Placing on top of the highest block would build out of the world.
+      if (!inWorld(wc) || !m_map.haveChunk(getChunkCoords(wc))) return;
 
       if (wc == getWorldCoords(m_states[eid]->position)                                  ||
           (wY(wc) != 0 && wc + BLOCK_YMINUS == getWorldCoords(m_states[eid]->position))   )
@@ -212,7 +219,7 @@ void GameStateManager::packetCSBlockPlacement(int32_t eid, int32_t X, int8_t Y,
 
         if (bp_res != CANNOT_PLACE && bp_res != CANNOT_PLACE_AIRFORCE)
         {
-          chunk.blockType(getLocalCoords(wc)) = block_id;
+          chunk.setBlockType(getLocalCoords(wc), block_id);
           chunk.taint();
 
           if (bp_res == OK_WITH_META)
@@ -300,12 +307,8 @@ void GameStateManager::packetCSPlayerPosition(int32_t eid, double X, double Y, d
 
   const RealCoords rc(X, Y, Z);
 
-  if (getChunkCoords(m_states[eid]->position) != getChunkCoords(rc))
-  {
-    sendMoreChunksToPlayer(eid);
-  }
-
-  m_states[eid]->position = rc;
+  // New chunks are sent by the chunk scheduler, see processChunkJobs().
+  m_states[eid]->moveTo(rc);
   m_states[eid]->stance   = stance;
 
   handlePlayerMove(eid);
@@ -329,7 +332,7 @@ void GameStateManager::packetCSPlayerPositionAndLook(int32_t eid, double X, doub
   if (m_states.find(eid) == m_states.end()) return;
 
   const RealCoords rc(X, Y, Z);
-  m_states[eid]->position = rc;
+  m_states[eid]->moveTo(rc);
   m_states[eid]->stance   = stance;
   m_states[eid]->pitch    = pitch;
   m_states[eid]->yaw      = yaw;
@@ -341,11 +344,6 @@ void GameStateManager::packetCSPlayerPositionAndLook(int32_t eid, double X, doub
     packetSCPlayerPositionAndLook(eid, X, Y, Z, stance, yaw, pitch, ground);
     m_states[eid]->state = PlayerState::SPAWNED;
   }
-  else if (getChunkCoords(m_states[eid]->position) != getChunkCoords(rc))
-  {
-    sendMoreChunksToPlayer(eid);
-  }
-
 }
 
 void GameStateManager::packetCSHoldingChange(int32_t eid, int16_t slot)
@@ -462,7 +460,10 @@ void GameStateManager::packetCSLoginRequest(int32_t eid, int32_t protocol_versio
 
   const WorldCoords start_pos = getWorldCoords(player.position);
 
-  sendMoreChunksToPlayer(eid);
+  player.view_distance = std::min(std::max(size_t(PLAYER_CHUNK_HORIZON), m_view_min), m_view_max);
+
+  // Just enough to stand on; the chunk scheduler takes care of the rest.
+  sendMoreChunksToPlayer(eid, PLAYER_CHUNK_LOGIN_HORIZON);
 
   packetSCSpawn(eid, start_pos);
 
@@ -525,8 +526,7 @@ void GameStateManager::packetCSSign(int32_t eid, int32_t X, int16_t Y, int32_t Z
 
 void GameStateManager::packetSCKeepAlive(int32_t eid)
 {
-  PacketCrafter p(PACKET_KEEP_ALIVE);
-  m_connection_manager.sendDataToClient(eid, p.craft(), "<keep alive>");
+  m_connection_manager.sendDataToClient(eid, SCKeepAlive::encode(), "<keep alive>");
 }
 
 void GameStateManager::packetSCKick(int32_t eid, const std::string & message)
@@ -536,100 +536,54 @@ void GameStateManager::packetSCKick(int32_t eid, const std::string & message)
   m_connection_manager.sendDataToClient(eid, p.craft());
 }
 
-void GameStateManager::packetSCPreChunk(int32_t eid, const ChunkCoords & cc, bool mode)
+void GameStateManager::packetSCPreChunk(int32_t eid, const ChunkCoords & cc, bool mode, EEgressLane lane)
 {
-  PacketCrafter q(PACKET_PRE_CHUNK);
-  q.addInt32(cX(cc)); // cX
-  q.addInt32(cZ(cc)); // cZ
-  q.addBool(mode);    // Mode (true = initialize, false = unload)
-  m_connection_manager.sendDataToClient(eid, q.craft());
+  // Mode: true = initialize, false = unload
+  m_connection_manager.sendDataToClient(eid, SCPreChunk::encode(cX(cc), cZ(cc), mode), NULL, lane, egressKey(cc));
 }
 
-void GameStateManager::packetSCMapChunk(int32_t eid, int32_t X, int32_t Y, int32_t Z, const std::string & data, size_t sizeX, size_t sizeY, size_t sizeZ)
+void GameStateManager::packetSCMapChunk(int32_t eid, int32_t X, int32_t Y, int32_t Z, const std::shared_ptr<const std::string> & data, size_t sizeX, size_t sizeY, size_t sizeZ, EEgressLane lane)
 {
-  PacketCrafter p(PACKET_MAP_CHUNK);
-  p.addInt32(X);    // wX
-  p.addInt16(Y);    // wY
-  p.addInt32(Z);    // wZ
-  p.addInt8(sizeX);
-  p.addInt8(sizeY);
-  p.addInt8(sizeZ);
-  p.addInt32(data.length());
-  p.addByteArray(data.data(), data.length());
-  m_connection_manager.sendDataToClient(eid, p.craft());
+  // The deflated data is shared with the chunk's cache, and goes out as it is, after the header.
+  m_connection_manager.sendSharedDataToClient(eid, SCMapChunkHeader::encode(X, Y, Z, sizeX, sizeY, sizeZ, data->length()), data, NULL, lane, egressKey(getChunkCoords(WorldCoords(X, Y, Z))));
 }
 
 void GameStateManager::packetSCSpawn(int32_t eid, const WorldCoords & wc)
 {
-  PacketCrafter p(PACKET_SPAWN_POSITION);
-  p.addInt32(wX(wc));  // X
-  p.addInt32(wY(wc));  // Y
-  p.addInt32(wZ(wc));  // Z
-  m_connection_manager.sendDataToClient(eid, p.craft());
+  m_connection_manager.sendDataToClient(eid, SCSpawnPosition::encode(wX(wc), wY(wc), wZ(wc)));
 }
 
 void GameStateManager::packetSCPlayerPositionAndLook(int32_t eid, double X, double Y, double Z, double stance, float yaw, float pitch, bool on_ground)
 {
-  PacketCrafter p(PACKET_PLAYER_POSITION_AND_LOOK);
-  p.addDouble(X);       // X
-  p.addDouble(Y);       // Y
-  p.addDouble(stance);  // stance
-  p.addDouble(Z);       // Z
-  p.addFloat(yaw);      // yaw
-  p.addFloat(pitch);    // pitch
-  p.addBool(on_ground); // on ground
-  m_connection_manager.sendDataToClient(eid, p.craft());
+  m_connection_manager.sendDataToClient(eid, SCPlayerPositionAndLook::encode(X, Y, stance, Z, yaw, pitch, on_ground));
 }
 
 std::string GameStateManager::rawPacketSCPlayerPositionAndLook(const RealCoords & rc, double stance, float yaw, float pitch, bool on_ground)
 {
-  PacketCrafter p(PACKET_PLAYER_POSITION_AND_LOOK);
-  p.addDouble(rX(rc));  // X
-  p.addDouble(rY(rc));  // Y
-  p.addDouble(stance);  // stance
-  p.addDouble(rZ(rc));  // Z
-  p.addFloat(yaw);      // yaw
-  p.addFloat(pitch);    // pitch
-  p.addBool(on_ground); // on ground
-  return p.craft();
+  return SCPlayerPositionAndLook::encode(rX(rc), rY(rc), stance, rZ(rc), yaw, pitch, on_ground);
 }
 
 void GameStateManager::packetSCSetSlot(int32_t eid, int8_t window, int16_t slot, int16_t item, int8_t count, int16_t uses)
 {
-  PacketCrafter p(PACKET_SET_SLOT);
-  p.addInt8(window);  // window #, 0 = inventory
-  p.addInt16(slot);   // slot #
-  p.addInt16(item);   // item id
-  p.addInt8(count);   // item count
-  p.addInt16(uses);   // uses
-  m_connection_manager.sendDataToClient(eid, p.craft());
+  // Window 0 is the inventory.
+  m_connection_manager.sendDataToClient(eid, SCSetSlot::encode(window, slot, item, count, uses));
 }
 
 void GameStateManager::packetSCHoldingChange(int32_t eid, int16_t slot)
 {
-  PacketCrafter p(PACKET_HOLDING_CHANGE);
-  p.addInt16(slot);
-  m_connection_manager.sendDataToClient(eid, p.craft());
+  m_connection_manager.sendDataToClient(eid, SCHoldingChange::encode(slot));
 }
 
 void GameStateManager::packetSCBlockChange(int32_t eid, const WorldCoords & wc, int8_t block_type, int8_t block_md)
 {
   std::cout << "Sending BlockChange to #" << std::dec << eid << ": " << wc << ", block type " << int(block_type) << std::endl;
 
-  PacketCrafter p(PACKET_BLOCK_CHANGE);
-  p.addInt32(wX(wc));    // X
-  p.addInt8 (wY(wc));    // Y
-  p.addInt32(wZ(wc));    // Z
-  p.addInt8(block_type); // block type
-  p.addInt8(block_md);   // block metadata
-  m_connection_manager.sendDataToClient(eid, p.craft());
+  m_connection_manager.sendDataToClient(eid, SCBlockChange::encode(wX(wc), wY(wc), wZ(wc), block_type, block_md), NULL, EGRESS_INTERACTIVE, egressKey(getChunkCoords(wc)));
 }
 
 void GameStateManager::packetSCTime(int32_t eid, int64_t ticks)
 {
-  PacketCrafter p(PACKET_TIME_UPDATE);
-  p.addInt64(ticks);
-  m_connection_manager.sendDataToClient(eid, p.craft());
+  m_connection_manager.sendDataToClient(eid, SCTimeUpdate::encode(ticks));
 }
 
 void GameStateManager::packetSCOpenWindow(int32_t eid, int8_t window_id, int8_t window_type, std::string title, int8_t slots)
@@ -646,35 +600,18 @@ void GameStateManager::packetSCPickupSpawn(int32_t eid, int32_t e, uint16_t type
 {
   // We ougth to randomise this a little
 
-  PacketCrafter p(PACKET_PICKUP_SPAWN);
-  p.addInt32(e);    // item EID
-  p.addInt16(type);
-  p.addInt8(count);
-  p.addInt16(da);   // damage or metadata
-  p.addInt32(wX(wc) * 32 + 16);
-  p.addInt32(wY(wc) * 32 + 16);
-  p.addInt32(wZ(wc) * 32 + 16);
-
-  p.addAngleAsByte(0);
-  p.addAngleAsByte(0);
-  p.addAngleAsByte(0);
-
-  m_connection_manager.sendDataToClient(eid, p.craft());
+  // da is the damage or metadata.
+  m_connection_manager.sendDataToClient(eid, SCPickupSpawn::encode(e, type, count, da, wX(wc) * 32 + 16, wY(wc) * 32 + 16, wZ(wc) * 32 + 16, 0, 0, 0));
 }
 
 void GameStateManager::packetSCCollectItem(int32_t eid, int32_t collectee_eid, int32_t collector_eid)
 {
-  PacketCrafter p(PACKET_COLLECT_ITEM);
-  p.addInt32(collectee_eid);    // item EID
-  p.addInt32(collector_eid);    // collector EID
-  m_connection_manager.sendDataToClient(eid, p.craft());
+  m_connection_manager.sendDataToClient(eid, SCCollectItem::encode(collectee_eid, collector_eid));
 }
 
 void GameStateManager::packetSCDestroyEntity(int32_t eid, int32_t e)
 {
-  PacketCrafter p(PACKET_DESTROY_ENTITY);
-  p.addInt32(e);                // item EID
-  m_connection_manager.sendDataToClient(eid, p.craft());
+  m_connection_manager.sendDataToClient(eid, SCDestroyEntity::encode(e));
 }
 
 void GameStateManager::packetSCChatMessage(int32_t eid, std::string message)
@@ -700,26 +637,15 @@ void GameStateManager::packetSCSpawnEntity(int32_t eid, int32_t e, const Fractio
 
 std::string GameStateManager::rawPacketSCEntityTeleport(int32_t e, const FractionalCoords & fc, double yaw, double pitch)
 {
-  PacketCrafter p(PACKET_ENTITY_TELEPORT);
-  p.addInt32(e);
-  p.addInt32(fX(fc));
-  p.addInt32(fY(fc));
-  p.addInt32(fZ(fc));
-  p.addAngleAsByte(yaw);
-  p.addAngleAsByte(pitch);
-  return p.craft();
+  return SCEntityTeleport::encode(e, fX(fc), fY(fc), fZ(fc), yaw, pitch);
 }
 
 std::string GameStateManager::rawPacketSCHoldingChange(int16_t slot)
 {
-  PacketCrafter p(PACKET_HOLDING_CHANGE);
-  p.addInt16(slot);
-  return p.craft();
+  return SCHoldingChange::encode(slot);
 }
 
 std::string GameStateManager::rawPacketSCDestroyEntity(int32_t e)
 {
-  PacketCrafter p(PACKET_DESTROY_ENTITY);
-  p.addInt32(e);
-  return p.craft();
+  return SCDestroyEntity::encode(e);
 }
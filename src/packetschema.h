@@ -0,0 +1,216 @@
+#ifndef H_PACKETSCHEMA
+#define H_PACKETSCHEMA
+
+
+#include <string>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include "packetcrafter.h"
+#include "constants.h"
+
+
+/* The layouts of all fixed-size packets, declared once.
+ *
+ * A schema is a packet type followed by its field types, in wire order, e.g.
+ *
+ *   typedef PacketSchema<PACKET_PLAYER_LOOK, float, float, bool> CSPlayerLook;
+ *
+ * From this, CSPlayerLook::size is the payload size (without the type byte), decode()
+ * reads all fields from a buffer at offsets fixed at compile time and hands them
+ * to a function object, and encode() builds the packet from its fields. Both are
+ * straight-line code; passing the wrong number of fields is a compile error.
+ */
+
+/// A rotation in degrees, sent as a single byte (256 steps per turn).
+struct Angle;
+
+/// Field codecs: the wire size of each field type, and how to read and write it.
+
+template <typename T> struct FieldCodec;
+
+template <> struct FieldCodec<bool>
+{
+  typedef bool type;
+  enum { size = 1 };
+  static inline type read(const unsigned char * p) { return p[0] != 0; }
+  static inline void write(PacketCrafter & c, type x) { c.addBool(x); }
+};
+
+template <> struct FieldCodec<int8_t>
+{
+  typedef int8_t type;
+  enum { size = 1 };
+  static inline type read(const unsigned char * p) { return int8_t(p[0]); }
+  static inline void write(PacketCrafter & c, type x) { c.addInt8(x); }
+};
+
+template <> struct FieldCodec<uint8_t>
+{
+  typedef uint8_t type;
+  enum { size = 1 };
+  static inline type read(const unsigned char * p) { return p[0]; }
+  static inline void write(PacketCrafter & c, type x) { c.addInt8(x); }
+};
+
+template <> struct FieldCodec<int16_t>
+{
+  typedef int16_t type;
+  enum { size = 2 };
+  static inline type read(const unsigned char * p) { uint16_t i; std::memcpy(&i, p, sizeof i); return int16_t(toBigEndian16(i)); }
+  static inline void write(PacketCrafter & c, type x) { c.addInt16(x); }
+};
+
+template <> struct FieldCodec<int32_t>
+{
+  typedef int32_t type;
+  enum { size = 4 };
+  static inline type read(const unsigned char * p) { uint32_t i; std::memcpy(&i, p, sizeof i); return int32_t(toBigEndian32(i)); }
+  static inline void write(PacketCrafter & c, type x) { c.addInt32(x); }
+};
+
+template <> struct FieldCodec<int64_t>
+{
+  typedef int64_t type;
+  enum { size = 8 };
+  static inline type read(const unsigned char * p) { uint64_t i; std::memcpy(&i, p, sizeof i); return int64_t(toBigEndian64(i)); }
+  static inline void write(PacketCrafter & c, type x) { c.addInt64(x); }
+};
+
+template <> struct FieldCodec<float>
+{
+  typedef float type;
+  enum { size = 4 };
+  static inline type read(const unsigned char * p) { const uint32_t i = FieldCodec<int32_t>::read(p); float x; std::memcpy(&x, &i, sizeof x); return x; }
+  static inline void write(PacketCrafter & c, type x) { c.addFloat(x); }
+};
+
+template <> struct FieldCodec<double>
+{
+  typedef double type;
+  enum { size = 8 };
+  static inline type read(const unsigned char * p) { const uint64_t i = FieldCodec<int64_t>::read(p); double x; std::memcpy(&x, &i, sizeof x); return x; }
+  static inline void write(PacketCrafter & c, type x) { c.addDouble(x); }
+};
+
+template <> struct FieldCodec<Angle>
+{
+  typedef double type;
+  enum { size = 1 };
+  static inline type read(const unsigned char * p) { return double(p[0]) / 256. * 360.; }
+  static inline void write(PacketCrafter & c, type x) { c.addAngleAsByte(x); }
+};
+
+
+/// The offset of field I, i.e. the total size of the fields before it.
+
+template <size_t I, typename... Fields> struct FieldOffset;
+
+template <> struct FieldOffset<0>
+{
+  enum { value = 0 };
+};
+
+template <typename F, typename... Fields> struct FieldOffset<0, F, Fields...>
+{
+  enum { value = 0 };
+};
+
+template <size_t I, typename F, typename... Fields> struct FieldOffset<I, F, Fields...>
+{
+  enum { value = FieldCodec<F>::size + FieldOffset<I - 1, Fields...>::value };
+};
+
+/// 0, 1, ..., N - 1 as a type, to walk the fields together with their offsets.
+
+template <size_t... I> struct Indices { };
+
+template <size_t N, size_t... I> struct MakeIndices : MakeIndices<N - 1, N - 1, I...> { };
+
+template <size_t... I> struct MakeIndices<0, I...> { typedef Indices<I...> type; };
+
+
+template <int Type, typename... Fields>
+struct PacketSchema
+{
+  enum { type = Type, size = FieldOffset<sizeof...(Fields), Fields...>::value };
+
+  /// Read the fields from the payload (the size bytes after the type byte) and call f with them, in wire order.
+
+  template <typename F> static inline void decode(const unsigned char * payload, F f)
+  {
+    decodeAt(payload, f, typename MakeIndices<sizeof...(Fields)>::type());
+  }
+
+  /// The whole packet, type byte included.
+
+  static inline std::string encode(typename FieldCodec<Fields>::type... fields)
+  {
+    PacketCrafter p(static_cast<uint8_t>(Type));
+    // Braced initialisers are evaluated left to right, so this writes the fields in order.
+    const int expand[] = { 0, (FieldCodec<Fields>::write(p, fields), 0)... };
+    (void)expand;
+    return p.craft();
+  }
+
+private:
+  template <typename F, size_t... I> static inline void decodeAt(const unsigned char * payload, F & f, Indices<I...>)
+  {
+    (void)payload;
+    f(FieldCodec<Fields>::read(payload + FieldOffset<I, Fields...>::value)...);
+  }
+};
+
+
+/**** Client to Server ****/
+
+typedef PacketSchema<PACKET_KEEP_ALIVE>                                               CSKeepAlive;
+typedef PacketSchema<PACKET_USE_ENTITY, int32_t, int32_t, bool>                       CSUseEntity;        // user, target, left click
+typedef PacketSchema<PACKET_PRE_CHUNK, int32_t, int32_t, bool>                        CSPreChunk;         // X, Z, mode
+typedef PacketSchema<PACKET_PLAYER, bool>                                             CSPlayer;           // on ground
+typedef PacketSchema<PACKET_PLAYER_POSITION, double, double, double, double, bool>    CSPlayerPosition;   // X, Y, stance, Z, on ground
+typedef PacketSchema<PACKET_PLAYER_LOOK, float, float, bool>                          CSPlayerLook;       // yaw, pitch, on ground
+typedef PacketSchema<PACKET_PLAYER_POSITION_AND_LOOK, double, double, double, double, float, float, bool>
+                                                                                      CSPlayerPositionAndLook; // X, stance (!), Y, Z, yaw, pitch, on ground
+typedef PacketSchema<PACKET_PLAYER_DIGGING, uint8_t, int32_t, uint8_t, int32_t, uint8_t> CSPlayerDigging; // status, X, Y, Z, face
+typedef PacketSchema<PACKET_HOLDING_CHANGE, int16_t>                                  CSHoldingChange;    // slot
+typedef PacketSchema<PACKET_ARM_ANIMATION, int32_t, int8_t>                           CSArmAnimation;     // EID, animation
+typedef PacketSchema<PACKET_ENTITY_CROUCH, int32_t, int8_t>                           CSEntityCrouch;     // EID, action
+typedef PacketSchema<PACKET_PICKUP_SPAWN, int32_t, int16_t, int8_t, int16_t, int32_t, int32_t, int32_t, Angle, Angle, Angle>
+                                                                                      CSPickupSpawn;      // EID, item, count, damage, X, Y, Z, rotation, pitch, roll
+typedef PacketSchema<PACKET_RESPAWN>                                                  CSRespawn;
+typedef PacketSchema<PACKET_INVENTORY_CLOSE, int8_t>                                  CSInventoryClose;   // window
+typedef PacketSchema<PACKET_TRANSACTION, int8_t, int16_t, bool>                       CSTransaction;      // window, action number, accepted
+
+// The protocol's sizes; a mistake in the field lists above stops the build.
+static_assert(CSUseEntity::size == 9 && CSPreChunk::size == 9 && CSPlayer::size == 1, "CS packet size");
+static_assert(CSPlayerPosition::size == 33 && CSPlayerLook::size == 9 && CSPlayerPositionAndLook::size == 41, "CS movement packet size");
+static_assert(CSPlayerDigging::size == 11 && CSHoldingChange::size == 2 && CSPickupSpawn::size == 24, "CS packet size");
+static_assert(CSArmAnimation::size == 5 && CSEntityCrouch::size == 5 && CSInventoryClose::size == 1 && CSTransaction::size == 4, "CS packet size");
+
+
+/**** Server to Client ****/
+
+typedef PacketSchema<PACKET_KEEP_ALIVE>                                               SCKeepAlive;
+typedef PacketSchema<PACKET_TIME_UPDATE, int64_t>                                     SCTimeUpdate;       // ticks
+typedef PacketSchema<PACKET_SPAWN_POSITION, int32_t, int32_t, int32_t>                SCSpawnPosition;    // X, Y, Z
+typedef PacketSchema<PACKET_PLAYER_POSITION_AND_LOOK, double, double, double, double, float, float, bool>
+                                                                                      SCPlayerPositionAndLook; // X, Y, stance, Z, yaw, pitch, on ground
+typedef PacketSchema<PACKET_HOLDING_CHANGE, int16_t>                                  SCHoldingChange;    // slot
+typedef PacketSchema<PACKET_PICKUP_SPAWN, int32_t, int16_t, int8_t, int16_t, int32_t, int32_t, int32_t, Angle, Angle, Angle>
+                                                                                      SCPickupSpawn;      // EID, item, count, damage, X, Y, Z, rotation, pitch, roll
+typedef PacketSchema<PACKET_COLLECT_ITEM, int32_t, int32_t>                           SCCollectItem;      // collectee, collector
+typedef PacketSchema<PACKET_DESTROY_ENTITY, int32_t>                                  SCDestroyEntity;    // EID
+typedef PacketSchema<PACKET_ENTITY_TELEPORT, int32_t, int32_t, int32_t, int32_t, Angle, Angle>
+                                                                                      SCEntityTeleport;   // EID, X, Y, Z, yaw, pitch
+typedef PacketSchema<PACKET_PRE_CHUNK, int32_t, int32_t, bool>                        SCPreChunk;         // X, Z, mode
+typedef PacketSchema<PACKET_MAP_CHUNK, int32_t, int16_t, int32_t, uint8_t, uint8_t, uint8_t, int32_t>
+                                                                                      SCMapChunkHeader;   // X, Y, Z, size - 1 (x3), length of the data that follows
+typedef PacketSchema<PACKET_BLOCK_CHANGE, int32_t, int8_t, int32_t, int8_t, int8_t>   SCBlockChange;      // X, Y, Z, type, metadata
+typedef PacketSchema<PACKET_SET_SLOT, int8_t, int16_t, int16_t, int8_t, int16_t>      SCSetSlot;          // window, slot, item, count, uses
+
+static_assert(SCPlayerPositionAndLook::size == 41 && SCEntityTeleport::size == 18 && SCMapChunkHeader::size == 17, "SC packet size");
+static_assert(SCBlockChange::size == 11 && SCSetSlot::size == 8 && SCPickupSpawn::size == 24, "SC packet size");
+
+
+#endif
@@ -0,0 +1,178 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+
+#include "generator.h"
+#include "random.h"
+#include "chunk.h"
+#include "map.h"
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+po::variables_map PROGRAM_OPTIONS;
+bool parseOptions(int argc, char * argv[], po::variables_map & options);
+bool parseRectangle(const std::string & s, ChunkCoords & lo, ChunkCoords & hi);
+
+
+
+int main(int argc, char * argv[])
+{
+  /// Stage I: Preparation
+
+  if (!parseOptions(argc, argv, PROGRAM_OPTIONS)) return 0;
+
+  const std::string outfn = PROGRAM_OPTIONS["outfile"].as<std::string>();
+  const std::string rect  = PROGRAM_OPTIONS["rect"].as<std::string>();
+  const int radius        = PROGRAM_OPTIONS["radius"].as<int>();
+
+  const unsigned int generators = PROGRAM_OPTIONS["generators"].as<unsigned int>() > 0 ?
+    PROGRAM_OPTIONS["generators"].as<unsigned int>() : std::max(1U, std::thread::hardware_concurrency());
+
+  if (outfn.empty())
+  {
+    std::cerr << "Please specify the base name of the output file. Type '-h' for help." << std::endl;
+    return 0;
+  }
+  else if (fs::exists(outfn + ".idx") || fs::exists(outfn + ".dat") || fs::exists(outfn + ".meta"))
+  {
+    std::cerr << "One of the output files already exists. To be safe, we abort." << std::endl;
+    return 0;
+  }
+
+  ChunkCoords lo(-radius, -radius), hi(radius, radius);
+
+  if (!rect.empty() && !parseRectangle(rect, lo, hi))
+  {
+    std::cerr << "Please specify the rectangle as \"X0,Z0,X1,Z1\" (in chunk coordinates). Type '-h' for help." << std::endl;
+    return 0;
+  }
+  else if (rect.empty() && radius < 0)
+  {
+    std::cerr << "The radius must not be negative. Type '-h' for help." << std::endl;
+    return 0;
+  }
+
+  // Nearest to the centre first, like the server does it.
+  const ChunkCoords centre((cX(lo) + cX(hi)) / 2, (cZ(lo) + cZ(hi)) / 2);
+
+  std::vector<ChunkCoords> ccs;
+  for (int32_t x = cX(lo); x <= cX(hi); ++x)
+    for (int32_t z = cZ(lo); z <= cZ(hi); ++z)
+      ccs.push_back(ChunkCoords(x, z));
+
+
+  /// Stage II: Set up the world and the generators
+
+  initPRNG(PROGRAM_OPTIONS["seed"].as<int>());
+  pNG->setQuality(PROGRAM_OPTIONS["noise-quality"].as<unsigned int>());
+
+  Map map(0, pNG->seed());
+
+  GeneratorPool pool(*pNG, generators);
+
+  std::cout << "Generating " << std::dec << ccs.size() << " chunks, from " << lo << " to " << hi << ", on "
+            << generators << " threads." << std::endl;
+
+
+  /// Stage III: Generate
+
+  const auto start = std::chrono::steady_clock::now();
+
+  std::vector<std::shared_future<std::shared_ptr<Chunk>>> futures;
+  futures.reserve(ccs.size());
+
+  for (auto it = ccs.cbegin(); it != ccs.cend(); ++it)
+  {
+    futures.push_back(pool.submit(*it, std::abs(cX(*it) - cX(centre)) + std::abs(cZ(*it) - cZ(centre))));
+  }
+
+  size_t percent = 0;
+
+  for (size_t i = 0; i < futures.size(); ++i)
+  {
+    std::shared_ptr<Chunk> chunk = futures[i].get();
+
+    // Keep the memory use down on big maps; the serializer reads frozen chunks directly.
+    chunk->freeze();
+    map.insertChunk(chunk);
+
+    if (100 * (i + 1) / futures.size() > percent)
+    {
+      percent = 100 * (i + 1) / futures.size();
+      std::cout << "\r  " << percent << "% ";
+      std::cout.flush();
+    }
+  }
+
+  const double seconds = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() / 1000.0;
+
+  std::cout << std::endl << "Generated " << ccs.size() << " chunks in " << seconds << " seconds ("
+            << (seconds > 0 ? ccs.size() / seconds : 0) << " chunks/s)." << std::endl;
+
+
+  /// Stage IV: Save
+
+  map.save(outfn);
+
+  std::cout << "All done! Start the server with \"--load " << outfn << "\"." << std::endl;
+}
+
+
+bool parseRectangle(const std::string & s, ChunkCoords & lo, ChunkCoords & hi)
+{
+  std::istringstream iss(s);
+  int32_t x0, z0, x1, z1;
+  char c1, c2, c3;
+
+  if (!(iss >> x0 >> c1 >> z0 >> c2 >> x1 >> c3 >> z1) || c1 != ',' || c2 != ',' || c3 != ',') return false;
+
+  lo = ChunkCoords(std::min(x0, x1), std::min(z0, z1));
+  hi = ChunkCoords(std::max(x0, x1), std::max(z0, z1));
+
+  return true;
+}
+
+bool parseOptions(int argc, char * argv[], po::variables_map & options)
+{
+  po::options_description desc("Schlagwetter Map Pre-Generator");
+  desc.add_options()
+    ("help,h", "Print usage information")
+    ("outfile,o", po::value<std::string>()->default_value(""), "The basename of the output file (\"myfile\" will create \"myfile.idx\", \"myfile.dat\" and \"myfile.meta\")")
+    ("seed,s", po::value<int>()->default_value(-1), "Set random seed (default: random)")
+    ("radius,r", po::value<int>()->default_value(16), "Generate all chunks within this many chunks of the origin (default: 16)")
+    ("rect,R", po::value<std::string>()->default_value(""), "Generate the chunks X0,Z0 to X1,Z1 instead (chunk coordinates, inclusive)")
+    ("generators,g", po::value<unsigned int>()->default_value(0), "Number of terrain generator threads (default: one per core)")
+    ("noise-quality,q", po::value<unsigned int>()->default_value(0), "Terrain noise sampling: 0 = exact, 1-3 = ever coarser, but faster (default: 0)")
+    ;
+
+  try
+  {
+    po::store(po::parse_command_line(argc, argv, desc), options);
+    po::notify(options);
+  }
+  catch (const std::exception & e)
+  {
+    std::cerr << "Error during command line parsing: " << e.what() << std::endl;
+    return false;
+  }
+  catch (...)
+  {
+    std::cerr << "Unknown error during command line parsing." << std::endl;
+    return false;
+  }
+
+  if (options.count("help"))
+  {
+    std::cout << desc << std::endl;
+    return false;
+  }
+
+  return true;
+}
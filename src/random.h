@@ -6,7 +6,7 @@
 
 /** We have two fundamental random generators:
  *
- *  1. The map generator (using libnoise), seeded with a specified value
+ *  1. The map generator (using libnoise or the built-in noise), seeded with a specified value
  *     (either on the command line or in a stored map file).
  *     It is imperative that we keep track of this seed value permanently.
  *
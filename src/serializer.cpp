@@ -33,13 +33,13 @@ ChunkMap::mapped_type Serializer::loadChunk(const ChunkCoords & cc)
   return std::make_shared<Chunk>(cc);
 }
 
-void Serializer::serialize()
+void Serializer::serialize(const std::string & basename)
 {
-  std::cout << "Saving map..." << std::endl;
+  std::cout << "Saving map to " << basename << "..." << std::endl;
 
-  std::ofstream idxfile("/tmp/mymap.idx", std::ios::binary);
-  std::ofstream datfile("/tmp/mymap.dat", std::ios::binary);
-  std::ofstream metfile("/tmp/mymap.meta", std::ios::binary);
+  std::ofstream idxfile(basename + ".idx", std::ios::binary);
+  std::ofstream datfile(basename + ".dat", std::ios::binary);
+  std::ofstream metfile(basename + ".meta", std::ios::binary);
 
   if (!idxfile || !datfile || !metfile)
   {
@@ -59,8 +59,11 @@ void Serializer::serialize()
   zdat.push(datfile);
   zmet.push(metfile);
 
+  auto buffer = std::make_shared<Chunk::ChunkData>();
+
   std::set<ChunkCoords> s;
-  for (auto i = m_chunk_map.cbegin(); i != m_chunk_map.cend(); ++i)
+  const std::vector<ChunkMap::value_type> chunks = m_chunk_map.snapshot();
+  for (auto i = chunks.cbegin(); i != chunks.cend(); ++i)
     s.insert(i->first);
 
   /* Save map chunk data */
@@ -70,7 +73,8 @@ void Serializer::serialize()
     int32_t X = cX(cc);
     int32_t Z = cZ(cc);
 
-    boost::iostreams::write(zdat, reinterpret_cast<const char*>(m_chunk_map[cc]->data().data()), Chunk::sizeBlockType + Chunk::sizeBlockMetaData);
+    m_chunk_map.find(cc)->exportData(*buffer);
+    boost::iostreams::write(zdat, reinterpret_cast<const char*>(buffer->data()), Chunk::sizeBlockType + Chunk::sizeBlockMetaData);
 
     boost::iostreams::write(zidx, reinterpret_cast<const char*>(&X), 4);
     boost::iostreams::write(zidx, reinterpret_cast<const char*>(&Z), 4);
@@ -140,6 +144,8 @@ void Serializer::deserialize(const std::string & basename)
   zdat.push(datfile);
   zmet.push(metfile);
 
+  auto buffer = std::make_shared<Chunk::ChunkData>();
+
   for (size_t counter = 0; ; ++counter)
   {
     int32_t X, Z, c;
@@ -149,11 +155,13 @@ void Serializer::deserialize(const std::string & basename)
 
     auto chunk = std::make_shared<Chunk>(ChunkCoords(X, Z));
 
-    if (boost::iostreams::read(zdat, reinterpret_cast<char *>(chunk->data().data()), Chunk::sizeBlockType + Chunk::sizeBlockMetaData) == -1)
+    if (boost::iostreams::read(zdat, reinterpret_cast<char *>(buffer->data()), Chunk::sizeBlockType + Chunk::sizeBlockMetaData) == -1)
     {
       break;
     }
 
+    chunk->importData(buffer->data(), Chunk::sizeBlockType + Chunk::sizeBlockMetaData);
+
     if (c != int(counter))
     {
       std::cerr << "Warning: Something unexpected when reading the map. (Read: " << c << ", Expected: " << counter << ")" << std::endl;
@@ -17,7 +17,8 @@ public:
   ChunkMap::mapped_type loadChunk(const ChunkCoords & cc);
   void writeChunk(ChunkMap::mapped_type chunk);
 
-  void serialize();
+  /// Writes basename.idx, basename.dat and basename.meta. Light is not saved; it is recomputed when chunks are sent.
+  void serialize(const std::string & basename);
   void deserialize(const std::string & basename);
 
 private:
@@ -8,6 +8,7 @@
 #include "inputparser.h"
 #include "constants.h"
 #include "random.h"
+#include "generator.h"
 
 // For PROGRAM_OPTIONS and ambientChunks(), respectively, if we precompute chunks.
 #include "cmdlineoptions.h"
@@ -40,7 +41,8 @@ Server::Server(const std::string & bindaddr, unsigned short int port)
   m_gsm(std::bind(&Server::sleepMilli, this, std::placeholders::_1), m_connection_manager, m_map),
   m_input_parser(m_gsm),
   m_deadline_timer(m_io_service),
-  m_sleep_next(200)
+  m_sleep_next(200),
+  m_tick_work(0)
 {
   boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address::from_string(bindaddr), port);
 
@@ -50,25 +52,32 @@ Server::Server(const std::string & bindaddr, unsigned short int port)
   m_acceptor.listen();
   m_acceptor.async_accept(m_next_connection->socket(), m_next_connection->peer(), std::bind(&Server::handleAccept, this, std::placeholders::_1));
 
+  const unsigned int generators = PROGRAM_OPTIONS["generators"].as<unsigned int>() > 0 ?
+    PROGRAM_OPTIONS["generators"].as<unsigned int>() : std::max(1U, std::thread::hardware_concurrency());
+
   if (!PROGRAM_OPTIONS["load"].as<std::string>().empty())
   {
     m_map.load(PROGRAM_OPTIONS["load"].as<std::string>());
     initPRNG(m_map.seed());
+    pNG->setQuality(PROGRAM_OPTIONS["noise-quality"].as<unsigned int>());
+    m_map.startGenerators(generators);
   }
   else
   {
     initPRNG(PROGRAM_OPTIONS["seed"].as<int>());
+    m_map.seed() = pNG->seed();  // the resolved one, in case we picked it at random, so that saving preserves it
+    pNG->setQuality(PROGRAM_OPTIONS["noise-quality"].as<unsigned int>());
+    m_map.startGenerators(generators);
+  }
 
-    std::vector<ChunkCoords> ac = ambientChunks(ChunkCoords(0, 0), PLAYER_CHUNK_HORIZON);
-    std::cout << "Precomputing map (" << std::dec << ac.size() << " chunks):" << std::endl << "  Generating terrain: ";
+  // Have the spawn area ready, so that the first players don't have to wait for it.
 
-    for (auto i = ac.cbegin(); i != ac.cend(); ++i)
-    {
-      m_map.ensureChunkIsLoaded(*i);
-      std::cout << "*"; std::cout.flush();
-    }
-    std::cout << std::endl << "Done!" << std::endl;
-  }
+  std::vector<ChunkCoords> ac = ambientChunks(ChunkCoords(0, 0), PLAYER_CHUNK_HORIZON);
+  std::cout << "Precomputing map (" << std::dec << ac.size() << " chunks):" << std::endl;
+
+  m_map.prepareChunks(ac, ChunkCoords(0, 0));
+
+  std::cout << "Done!" << std::endl;
 }
 
 void Server::runIO()
@@ -132,14 +141,10 @@ void Server::runInputProcessing()
           cd = it->second;
         }
 
-        // processIngress() only returns true if all data has been processed.
-        // While it runs, we are not holding any mutexes locked. If we can't
-        // process all data, we put the EID back onto the pending queue.
-        if (!processIngress(eid, cd))
-        {
-          std::lock_guard<std::recursive_mutex> lock(m_connection_manager.m_pending_mutex);
-          m_connection_manager.m_pending_eids.push_back(eid);
-        }
+        // processIngress() handles all complete packets; while it runs, we are not holding any
+        // mutexes locked. An incomplete packet stays in the queue: there's no point in trying
+        // again before more data has arrived, and then the EID will be pending again anyway.
+        processIngress(eid, cd);
       }
 
     } // scope of the "input ready" lock
@@ -203,8 +208,12 @@ void Server::processSchedule200ms(int dt)
       m_gsm.sendToAll(std::bind(&GameStateManager::packetSCChatMessage, &m_gsm, std::placeholders::_1, ss.str()));
   }
 
+  m_gsm.processChunkJobs();
+
   const long long int work_time = clockTick() - timer;
 
+  m_tick_work = std::max(m_tick_work, work_time);
+
   // Try to get the next call back in rhythm.
   m_sleep_next = work_time > 200 ? 0 : 200 - work_time;
 }
@@ -220,6 +229,11 @@ void Server::processSchedule1s()
   /* do stuff */
   (void)now;
 
+  m_connection_manager.dropHopelessClients();
+
+  m_gsm.adaptViewDistances(m_tick_work);
+  m_tick_work = 0;
+
 
   // We just gather the active eids quickly and don't hang on to the mutex...
   std::list<int32_t> todo;
@@ -254,55 +268,19 @@ void Server::processSchedule10s()
   /* do stuff */
   (void)now;
 
+  m_gsm.freezeIdleChunks();
+
 
   timer = clockTick();
 }
 
-bool Server::processIngress(int32_t eid, std::shared_ptr<SyncQueue> d)
+void Server::processIngress(int32_t eid, std::shared_ptr<SyncQueue> d)
 {
-  while (!d->empty())
-  {
-    const unsigned char first_byte(d->front());
-    const auto pit = PACKET_INFO.find(EPacketNames(first_byte));
+  // Don't even look before the incomplete packet from last time can be complete.
+  if (d->size() < d->wanted()) return;
 
-    if (pit != PACKET_INFO.end())
-    {
-      const size_t psize = pit->second.size; // excludes initial type byte!
-
-      if (psize != size_t(PACKET_VARIABLE_LEN) && d->size() >= psize + 1)
-      {
-        std::vector<unsigned char> x(psize + 1);
-        for (size_t k = 0; k < psize + 1; ++k)  x[k] = d->pop();
-
-        // Here we are guaranteed to process a whole packet.
-        m_input_parser.immediateDispatch(eid, x);
-      }
-      else if (psize == size_t(PACKET_VARIABLE_LEN))
-      {
-        if (!m_input_parser.dispatchIfEnoughData(eid, d)) 
-        {
-          // At this stage, the queue didn't have enough data...
-          return false;
-        }
-        // ... while at this stage we managed to extract a whole packet.
-
-      }
-      else
-      {
-        return false;
-      }
-    }
-
-    else // pit == end()
-    {
-      if (pit == PACKET_INFO.end()) std::cout << "[Packet ID unkown] ";
-      std::cout << "Unintellegible data! Clearing buffer for client #" << eid << ". First byte was "
-                << std::setw(2) << std::setfill('0') << std::hex << (unsigned int)(first_byte) << std::endl;
-      d->clear();
-      return true;
-    }
-  }
-  return true;
+  // Everything that is complete goes to the game state in one go.
+  if (m_input_parser.extractBatch(eid, *d)) m_input_parser.dispatchBatch(eid);
 }
 
 void Server::stop()
@@ -37,7 +37,7 @@ public:
   void stop();
 
   /// Processors.
-  bool processIngress(int32_t eid, std::shared_ptr<SyncQueue> d);
+  void processIngress(int32_t eid, std::shared_ptr<SyncQueue> d);
   void processSchedule200ms(int actual_time_interval);
   void processSchedule1s();
   void processSchedule10s();
@@ -81,6 +81,9 @@ private:
   /// An alarm clock.
   boost::asio::deadline_timer m_deadline_timer;
   unsigned int m_sleep_next;
+
+  /// The longest timer tick (ms) since the view distances were last adapted.
+  long long int m_tick_work;
   inline void sleepMilli(unsigned int t)
   {
     m_deadline_timer.expires_from_now(boost::posix_time::milliseconds(t));
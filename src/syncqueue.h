@@ -3,6 +3,7 @@
 
 
 #include <deque>
+#include <algorithm>
 #include <mutex>
 #include <iostream>
 
@@ -13,7 +14,7 @@
 class SyncQueue
 {
 public:
-  SyncQueue() : m_queue(), m_utex() { }
+  SyncQueue() : m_queue(), m_utex(), m_wanted(0) { }
 
   typedef std::recursive_mutex Mutex;
 
@@ -27,24 +28,14 @@ public:
     m_queue.push_back(x);
   }
 
-  inline void pushMaybeAndClear(std::deque<unsigned char> & queue)
+  /// Move everything over from queue. The parser only holds the lock while it takes packets off.
+  inline void pushAndClear(std::deque<unsigned char> & queue)
   {
-    if (m_utex.try_lock())
     {
+      std::lock_guard<Mutex> lock(m_utex);
       m_queue.insert(m_queue.end(), queue.begin(), queue.end());
-      m_utex.unlock();
-      queue.clear();
-    }
-    else
-    {
-      std::cerr << "Warning: SyncQueue was locked; consider reworking the thread model." << std::endl;
     }
-  }
-
-  // This one is only needed to rewind an aborted read.
-  template <typename T> inline void pushFrontUnsafe(T beg, T end)
-  {
-    m_queue.insert(m_queue.begin(), beg, end);
+    queue.clear();
   }
 
   inline unsigned char pop()
@@ -59,15 +50,12 @@ public:
     return x;
   }
 
-  inline unsigned char pop_unsafe()
+  /// Remove the first n bytes into out, under one lock.
+  inline void pop(unsigned char * out, size_t n)
   {
-#if DEBUG
-    if (m_queue.empty()) { throw "Panic in SyncQueue::pop()!"; }
-#endif
-
-    unsigned char x = m_queue.front();
-    m_queue.pop_front();
-    return x;
+    std::lock_guard<Mutex> lock(m_utex);
+    std::copy(m_queue.begin(), m_queue.begin() + n, out);
+    m_queue.erase(m_queue.begin(), m_queue.begin() + n);
   }
 
   inline unsigned char front()
@@ -86,6 +74,10 @@ public:
     m_queue.clear();
   }
 
+  /// How many bytes the parser needs before another attempt is worthwhile; only for the input thread.
+  inline size_t wanted() const { return m_wanted; }
+  inline void setWanted(size_t n) { m_wanted = n; }
+
   inline size_t size() const { return m_queue.size(); }
   inline bool  empty() const { return m_queue.empty(); }
 
@@ -95,6 +87,7 @@ public:
 private:
   std::deque<unsigned char> m_queue;
   Mutex m_utex;
+  size_t m_wanted;
 };
 
 
@@ -1,13 +1,11 @@
 #include <cstdio>
-#include <algorithm>
-#include <iterator>
+#include <string>
 #include "packetcrafter.h"
 #include "inputhelper.h"
 
-template<typename S>
-void hexString(SyncQueue d)
+void hexString(const std::string & d)
 {
-  printf("Deque of size = %u. Data: ", d.size());
+  printf("Packet of size = %u. Data: ", (unsigned int)(d.size()));
   for (auto i = d.begin(); i != d.end(); ++i)
   {
     if (i != d.begin()) printf(", ");
@@ -19,9 +17,6 @@ void hexString(SyncQueue d)
 
 int main()
 {
-
-  std::list<unsigned char> tmp;
-
   signed short int a = -1, b = 12, c = -20000;
   unsigned short int x = 234, y = 1, z = -1;
 
@@ -35,21 +30,21 @@ int main()
   p.addInt16(z);
 
   std::string s = p.craft();
-  std::deque<unsigned char> D;
-  std::copy(s.begin(), s.end(), std::back_inserter(D));
 
   printf("In:  %d %d %d %u %u %u\n", a,b,c,x,y,z);
-  hexString(D);
+  hexString(s);
+
+  PacketReader D(reinterpret_cast<const unsigned char *>(s.data()));
 
-  int8_t c0 = readInt8(D, tmp);
-  signed short int c1 = readInt16(D, tmp);
-  signed short int c2 = readInt16(D, tmp);
-  signed short int c3 = readInt16(D, tmp);
-  unsigned short int c11 = readInt16(D, tmp);
-  unsigned short int c12 = readInt16(D, tmp);
-  unsigned short int c13 = readInt16(D, tmp);
+  int8_t c0 = D.read<int8_t>();
+  signed short int c1 = D.read<int16_t>();
+  signed short int c2 = D.read<int16_t>();
+  signed short int c3 = D.read<int16_t>();
+  unsigned short int c11 = D.read<int16_t>();
+  unsigned short int c12 = D.read<int16_t>();
+  unsigned short int c13 = D.read<int16_t>();
 
-  printf("Out: %d %d %d %d %u %u %u : Final size = %u\n", c0,c1,c2,c3,c11,c12,c13, D.size());
+  printf("Out: %d %d %d %d %u %u %u\n", c0,c1,c2,c3,c11,c12,c13);
 
 
   signed int a1 = -2;
@@ -60,28 +55,25 @@ int main()
   q.addInt32(a2);
   std::string v = q.craft();
 
-  std::deque<unsigned char> F;
-  std::copy(v.begin(), v.end(), std::back_inserter(F));
-
   printf("\nIn:  %d %u\n", a1, a2);
-  hexString(F);
+  hexString(v);
+
+  PacketReader F(reinterpret_cast<const unsigned char *>(v.data()));
 
-  int8_t b0 = readInt8(F, tmp);
-  signed int b1 = readInt32(F, tmp);
-  unsigned int b2 = readInt32(F, tmp); 
-  printf("Out: %d %d %u : Final size = %u\n", b0, b1, b2, F.size());
+  int8_t b0 = F.read<int8_t>();
+  signed int b1 = F.read<int32_t>();
+  unsigned int b2 = F.read<int32_t>();
+  printf("Out: %d %d %u\n", b0, b1, b2);
 
 
   printf("\n");
-  std::deque<unsigned char> G;
-  G.push_back(0xFF);
-  G.push_back(0xFF);
-  G.push_back(0xFF);
-  G.push_back(0xFF);
+  const std::string G(4, char(0xFF));
 
   hexString(G);
 
-  int16_t d1 = readInt16(G, tmp);
-  uint16_t d2 = readInt16(G, tmp);
-  printf("%d %u : Final size = %u\n", d1, d2, G.size());
+  PacketReader R(reinterpret_cast<const unsigned char *>(G.data()));
+
+  int16_t d1 = R.read<int16_t>();
+  uint16_t d2 = R.read<int16_t>();
+  printf("%d %u\n", d1, d2);
 }
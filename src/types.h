@@ -29,8 +29,6 @@ long long int clockTick();
 /// Good old C standard, never fixed the behaviour of signed division...
 
 inline unsigned int MyMod(int a, unsigned int b) { int c = a % b; while (c < 0) c += b; return (unsigned int)(c); }
-inline unsigned int MyMod16(int a) { return MyMod(a, 16); }
-inline unsigned int MyMod32(int a) { return MyMod(a, 32); }
 inline   signed int MyDiv(int num, int den)
 {
   if ((num < 0 && den < 0) || (num >= 0 && den >= 0)) return num / den;
@@ -39,8 +37,12 @@ inline   signed int MyDiv(int num, int den)
 
   return MyDiv(-num, -den);
 }
-inline   signed int MyDiv16(int num) { return MyDiv(num, 16); }
-inline   signed int MyDiv32(int num) { return MyDiv(num, 32); }
+
+/// ...but for powers of two, shifting and masking (of two's complement numbers) does exactly what we want.
+inline unsigned int MyMod16(int a)   { return a & 0x0F; }
+inline unsigned int MyMod32(int a)   { return a & 0x1F; }
+inline   signed int MyDiv16(int num) { return num >> 4; }
+inline   signed int MyDiv32(int num) { return num >> 5; }
 
 
 
@@ -65,30 +67,75 @@ inline   signed int MyDiv32(int num) { return MyDiv(num, 32); }
 
 **/
 
-typedef std::tuple<int32_t, int32_t, int32_t> WorldCoords;
-typedef std::tuple<size_t, size_t, size_t>    LocalCoords;
-typedef std::pair<int32_t, int32_t>           ChunkCoords;      // Coordinates _of_ the chunk, not "within" the chunk.
+/// World coordinates are three plain integers. The packed key is only used for hashing.
+struct WorldCoords
+{
+  constexpr WorldCoords() : x(0), y(0), z(0) { }
+  constexpr WorldCoords(int32_t x, int32_t y, int32_t z) : x(x), y(y), z(z) { }
+
+  int32_t x, y, z;
+};
+
+/// Local coordinates are packed into 16 bits, in the same order that Chunk uses within its
+/// 16-block sections: bits 0-3 are y mod 16, 4-7 are z, 8-11 are x, and 12-15 are y / 16.
+/// Heights that don't fit (negative, or 256 and up) get section 15, so they never alias a real block.
+struct LocalCoords
+{
+  constexpr LocalCoords() : index(0) { }
+  constexpr LocalCoords(size_t x, size_t y, size_t z)
+    : index(uint16_t((y & 0x0F) | (z & 0x0F) << 4 | (x & 0x0F) << 8 | (y < 256 ? y >> 4 : 0x0F) << 12)) { }
+
+  /// The vertical section (y / 16) and the index within that section.
+  constexpr size_t section()      const { return index >> 12; }
+  constexpr size_t sectionIndex() const { return index & 0x0FFF; }
+
+  uint16_t index;
+};
+
+/// Coordinates _of_ the chunk, not "within" the chunk.
+struct ChunkCoords
+{
+  constexpr ChunkCoords() : x(0), z(0) { }
+  constexpr ChunkCoords(int32_t x, int32_t z) : x(x), z(z) { }
+
+  /// Both coordinates in one 64-bit word, for hashing and comparison.
+  constexpr uint64_t key() const { return (uint64_t(uint32_t(x)) << 32) | uint32_t(z); }
+
+  int32_t x, z;
+};
+
 typedef std::tuple<int64_t, int64_t, int64_t> FractionalCoords; // 32 units per block, fixed-point with 5 fractional bits.
 typedef std::tuple<double, double, double>    RealCoords;       // real * 32 = fractional; real(.5) = frac(-16) = world(-1)
 
-inline int32_t wX(const WorldCoords & wc) { return std::get<0>(wc); }
-inline int32_t & wX(WorldCoords & wc) { return std::get<0>(wc); }
-inline int32_t wY(const WorldCoords & wc) { return std::get<1>(wc); }
-inline int32_t & wY(WorldCoords & wc) { return std::get<1>(wc); }
-inline int32_t wZ(const WorldCoords & wc) { return std::get<2>(wc); }
-inline int32_t & wZ(WorldCoords & wc) { return std::get<2>(wc); }
-
-inline size_t lX(const LocalCoords & lc) { return std::get<0>(lc); }
-inline size_t & lX(LocalCoords & lc) { return std::get<0>(lc); }
-inline size_t lY(const LocalCoords & lc) { return std::get<1>(lc); }
-inline size_t & lY(LocalCoords & lc) { return std::get<1>(lc); }
-inline size_t lZ(const LocalCoords & lc) { return std::get<2>(lc); }
-inline size_t & lZ(LocalCoords & lc) { return std::get<2>(lc); }
-
-inline int32_t cX(const ChunkCoords & cc) { return cc.first; }
-inline int32_t & cX(ChunkCoords & cc) { return cc.first; }
-inline int32_t cZ(const ChunkCoords & cc) { return cc.second; }
-inline int32_t & cZ(ChunkCoords & cc) { return cc.second; }
+inline bool operator==(const WorldCoords & a, const WorldCoords & b) { return a.x == b.x && a.y == b.y && a.z == b.z; }
+inline bool operator!=(const WorldCoords & a, const WorldCoords & b) { return !(a == b); }
+inline bool operator< (const WorldCoords & a, const WorldCoords & b) { return a.x < b.x || (a.x == b.x && (a.y < b.y || (a.y == b.y && a.z < b.z))); }
+
+inline bool operator==(const LocalCoords & a, const LocalCoords & b) { return a.index == b.index; }
+inline bool operator!=(const LocalCoords & a, const LocalCoords & b) { return a.index != b.index; }
+
+inline bool operator==(const ChunkCoords & a, const ChunkCoords & b) { return a.key() == b.key(); }
+inline bool operator!=(const ChunkCoords & a, const ChunkCoords & b) { return a.key() != b.key(); }
+inline bool operator< (const ChunkCoords & a, const ChunkCoords & b) { return a.x < b.x || (a.x == b.x && a.z < b.z); }
+
+inline int32_t wX(const WorldCoords & wc) { return wc.x; }
+inline int32_t & wX(WorldCoords & wc) { return wc.x; }
+inline int32_t wY(const WorldCoords & wc) { return wc.y; }
+inline int32_t & wY(WorldCoords & wc) { return wc.y; }
+inline int32_t wZ(const WorldCoords & wc) { return wc.z; }
+inline int32_t & wZ(WorldCoords & wc) { return wc.z; }
+
+/// Whether the height is inside the world, i.e. whether there is a block there at all.
+inline bool inWorld(const WorldCoords & wc) { return wc.y >= 0 && wc.y <= 127; }
+
+inline size_t lX(const LocalCoords & lc) { return (lc.index >> 8) & 0x0F; }
+inline size_t lY(const LocalCoords & lc) { return (lc.index & 0x0F) | ((lc.index >> 12) << 4); }
+inline size_t lZ(const LocalCoords & lc) { return (lc.index >> 4) & 0x0F; }
+
+inline int32_t cX(const ChunkCoords & cc) { return cc.x; }
+inline int32_t & cX(ChunkCoords & cc) { return cc.x; }
+inline int32_t cZ(const ChunkCoords & cc) { return cc.z; }
+inline int32_t & cZ(ChunkCoords & cc) { return cc.z; }
 
 inline int64_t fX(const FractionalCoords & fc) { return std::get<0>(fc); }
 inline int64_t & fX(FractionalCoords & fc) { return std::get<0>(fc); }
@@ -184,25 +231,31 @@ enum Direction
   BLOCK_XPLUS  = 5
 };
 
+/// The unit offsets, indexed by Direction.
+struct DirectionOffset { int32_t dx, dy, dz; };
+
+constexpr DirectionOffset DIRECTION_OFFSETS[6] = {
+  {  0, -1,  0 },  // BLOCK_YMINUS
+  {  0, +1,  0 },  // BLOCK_YPLUS
+  {  0,  0, -1 },  // BLOCK_ZMINUS
+  {  0,  0, +1 },  // BLOCK_ZPLUS
+  { -1,  0,  0 },  // BLOCK_XMINUS
+  { +1,  0,  0 }   // BLOCK_XPLUS
+};
+
 inline WorldCoords & operator+=(WorldCoords & wc, Direction dir)
 {
-  switch (dir)
-  {
-  case BLOCK_XMINUS: { --wX(wc); break; }
-  case BLOCK_XPLUS:  { ++wX(wc); break; }
-  case BLOCK_YMINUS: { --wY(wc); break; }
-  case BLOCK_YPLUS:  { ++wY(wc); break; }
-  case BLOCK_ZMINUS: { --wZ(wc); break; }
-  case BLOCK_ZPLUS:  { ++wZ(wc); break; }
-  default: { std::cout << "Invalid direction received!" << std::endl; }
-  }
+  const DirectionOffset & d = DIRECTION_OFFSETS[dir];
+  wc.x += d.dx;
+  wc.y += d.dy;
+  wc.z += d.dz;
   return wc;
 }
 
 inline const WorldCoords operator+(const WorldCoords & wc, Direction dir)
 {
-  WorldCoords wcnew(wc);
-  return wcnew += dir;
+  const DirectionOffset & d = DIRECTION_OFFSETS[dir];
+  return WorldCoords(wc.x + d.dx, wc.y + d.dy, wc.z + d.dz);
 }
 
 
@@ -259,8 +312,40 @@ struct TupleHashValueImpl<Tuple, 0>
   }
 };
 
+/*  The coordinate types are hashed by scrambling their packed keys with the
+ *  SplitMix64 finalizer, so that neighbouring coordinates spread evenly.
+ */
+
+inline uint64_t avalanche(uint64_t k)
+{
+  k ^= k >> 30;
+  k *= 0xBF58476D1CE4E5B9ULL;
+  k ^= k >> 27;
+  k *= 0x94D049BB133111EBULL;
+  k ^= k >> 31;
+  return k;
+}
+
 namespace std
 {
+  template<> struct hash<ChunkCoords>
+  {
+    inline std::size_t operator()(const ChunkCoords & cc) const { return avalanche(cc.key()); }
+  };
+
+  template<> struct hash<WorldCoords>
+  {
+    inline std::size_t operator()(const WorldCoords & wc) const
+    {
+      return avalanche(ChunkCoords(wc.x, wc.z).key() ^ (uint64_t(uint32_t(wc.y)) * 0x9E3779B97F4A7C15ULL));
+    }
+  };
+
+  template<> struct hash<LocalCoords>
+  {
+    inline std::size_t operator()(const LocalCoords & lc) const { return avalanche(lc.index); }
+  };
+
   template<typename ...Args> struct hash<std::tuple<Args...>>
   {
     inline std::size_t operator()(const std::tuple<Args...> & v) const
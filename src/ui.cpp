@@ -1,8 +1,10 @@
 #include <iostream>
 #include <iomanip>
+#include <cstdlib>
 #include "ui.h"
 #include "server.h"
 #include "packetcrafter.h"
+#include "generator.h"
 
 std::string SimpleUI::readline(const std::string & prompt)
 {
@@ -67,12 +69,15 @@ bool pump(Server & server, UI & ui)
               << "Welcome, friend. This is Schlagwetter, a Minecraft server." << std::endl
               << "Please help yourself to the following commands:" << std::endl
               << std::endl
-              << "  list:                    Lists all connected users" << std::endl
+              << "  list:                    Lists all connected users, with their egress queue depths" << std::endl
               << "  dump:                    Dump each connection's data" << std::endl
               << "  raw <client> <data>:     Sends raw data to a client (prob. not very useful)" << std::endl
               << "  kick <client> <message>: Kicks a client with a given message" << std::endl
               << "  showinv:                 Lists world storage units (chests, furnaces, dispensers)" << std::endl
               << "  save:                    Write out the current map to a file" << std::endl
+              << "  mapinfo:                 Shows the number of loaded (and frozen) chunks and their memory use" << std::endl
+              << "  genbench [n]:            Times the terrain generator at each noise quality on n chunks (default: 50)" << std::endl
+              << "  view [<client> <r|auto>]: Shows the players' view distances, or fixes one (\"auto\" lets it adapt again)" << std::endl
               << "  exit:                    Shuts down the server" << std::endl
               << std::endl;
   }
@@ -84,6 +89,8 @@ bool pump(Server & server, UI & ui)
       std::cout << "Connection #" << std::dec << (*i)->EID() << ": " << (*i)->peer().address().to_string() << ":" << std::dec << (*i)->peer().port()
                 << ", #refs = " << i->use_count();
       if (di != server.m_connection_manager.clientData().end()) std::cout << ", " << di->second->size() << " bytes of unprocessed data";
+      std::cout << ", egress: " << (*i)->queuedPackets(EGRESS_INTERACTIVE) << " interactive (" << (*i)->queuedBytes(EGRESS_INTERACTIVE) / 1024 << " KiB), "
+                << (*i)->queuedPackets(EGRESS_BULK) << " bulk (" << (*i)->queuedBytes(EGRESS_BULK) / 1024 << " KiB)" << ((*i)->congested() ? ", congested" : "");
       std::cout << std::endl;
     }
   }
@@ -154,6 +161,44 @@ bool pump(Server & server, UI & ui)
   {
     server.m_map.save();
   }
+  else if (line.compare(0, 7, "mapinfo") == 0)
+  {
+    // This is not thread-safe either.
+    std::cout << "Chunks in memory: " << std::dec << server.m_map.chunkCount() << " (" << server.m_map.coldChunkCount() << " frozen, "
+              << server.m_map.storageChunkCount() << " with storage blocks), approx. " << server.m_map.residentSize() / 1024 << " KiB." << std::endl;
+  }
+  else if (line.compare(0, 8, "genbench") == 0)
+  {
+    std::istringstream s(line);
+    std::string tmp;
+    size_t n = 50;
+
+    s >> tmp >> n;
+
+    // Uses private copies of the noise generator, so this is safe to run alongside the server.
+    benchmarkGenerator(*pNG, n);
+  }
+  else if (line.compare(0, 4, "view") == 0)
+  {
+    std::istringstream s(line);
+    std::string tmp, r;
+    int32_t eid = -1;
+
+    s >> tmp >> eid >> r;
+
+    if (eid == -1)
+    {
+      server.m_gsm.printViewDistances();
+    }
+    else if (r.empty() || (r != "auto" && std::atoi(r.c_str()) <= 0))
+    {
+      std::cout << "Syntax: view <client> <r|auto>" << std::endl;
+    }
+    else if (!server.m_gsm.setViewDistance(eid, r == "auto" ? 0 : std::atoi(r.c_str())))
+    {
+      std::cout << "No such client #" << std::dec << eid << "." << std::endl;
+    }
+  }
   else if (line.compare(0, 7, "showinv") == 0)
   {
     std::cout << "World storage units:" << std::endl;
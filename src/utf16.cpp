@@ -0,0 +1,184 @@
+#include <cstdint>
+
+#include "utf16.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+  const uint32_t REPLACEMENT_CHARACTER = 0xFFFD;
+
+  inline unsigned char * putUnit(unsigned char * q, uint32_t u)
+  {
+    q[0] = (u >> 8) & 0xFF;
+    q[1] =  u       & 0xFF;
+    return q + 2;
+  }
+
+  /* Decodes one UTF-8 sequence at s (s < end), which is not plain ASCII, and writes
+   * it as one or two code units. On malformed input, the lead byte and the
+   * continuation bytes that were valid so far are replaced by a single U+FFFD.
+   */
+  inline unsigned char * putSequence(const unsigned char * & s, const unsigned char * end, unsigned char * q)
+  {
+    const unsigned char c = *s++;
+
+    // The number of continuation bytes, and the range of the first one (which rules out overlong forms, surrogates and values beyond U+10FFFF).
+    size_t n;
+    unsigned char lo = 0x80, hi = 0xBF;
+    uint32_t cp;
+
+    if      (c >= 0xC2 && c <= 0xDF) { n = 1; cp = c & 0x1F; }
+    else if (c >= 0xE0 && c <= 0xEF) { n = 2; cp = c & 0x0F; if (c == 0xE0) lo = 0xA0; if (c == 0xED) hi = 0x9F; }
+    else if (c >= 0xF0 && c <= 0xF4) { n = 3; cp = c & 0x07; if (c == 0xF0) lo = 0x90; if (c == 0xF4) hi = 0x8F; }
+    else return putUnit(q, REPLACEMENT_CHARACTER);
+
+    for (size_t i = 0; i < n; ++i, lo = 0x80, hi = 0xBF)
+    {
+      if (s == end || *s < lo || *s > hi) return putUnit(q, REPLACEMENT_CHARACTER);
+      cp = (cp << 6) | (*s++ & 0x3F);
+    }
+
+    if (cp < 0x10000) return putUnit(q, cp);
+
+    cp -= 0x10000;
+    q = putUnit(q, 0xD800 | (cp >> 10));
+    return putUnit(q, 0xDC00 | (cp & 0x3FF));
+  }
+
+  inline char * putUTF8(char * q, uint32_t cp)
+  {
+    if (cp < 0x80)
+    {
+      *q++ = char(cp);
+    }
+    else if (cp < 0x800)
+    {
+      *q++ = char(0xC0 | (cp >> 6));
+      *q++ = char(0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x10000)
+    {
+      *q++ = char(0xE0 |  (cp >> 12));
+      *q++ = char(0x80 | ((cp >> 6) & 0x3F));
+      *q++ = char(0x80 |  (cp       & 0x3F));
+    }
+    else
+    {
+      *q++ = char(0xF0 |  (cp >> 18));
+      *q++ = char(0x80 | ((cp >> 12) & 0x3F));
+      *q++ = char(0x80 | ((cp >>  6) & 0x3F));
+      *q++ = char(0x80 |  (cp        & 0x3F));
+    }
+    return q;
+  }
+
+  inline uint32_t getUnit(const unsigned char * p) { return uint32_t(p[0]) << 8 | p[1]; }
+
+#if defined(__SSE2__)
+
+  /// Widens the ASCII run at the start of [s, end) to UTF-16BE, sixteen bytes at a time; stops before the first block with a non-ASCII byte.
+  inline void widenASCII(const unsigned char * & s, const unsigned char * end, unsigned char * & q)
+  {
+    const __m128i zero = _mm_setzero_si128();
+
+    for ( ; end - s >= 16; s += 16, q += 32)
+    {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+      if (_mm_movemask_epi8(v) != 0) break;
+
+      // Interleaving with zeros in front gives the big-endian code units.
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(q),      _mm_unpacklo_epi8(zero, v));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(q + 16), _mm_unpackhi_epi8(zero, v));
+    }
+  }
+
+  /// Narrows the run of ASCII code units at the start of [p, end) to UTF-8, sixteen at a time.
+  inline void narrowASCII(const unsigned char * & p, const unsigned char * end, char * & q)
+  {
+    // Loaded as little-endian 16-bit lanes, the first byte of a code unit is in the low half:
+    // the unit is ASCII if that byte is zero and the top bit of the second one is clear.
+    const __m128i mask = _mm_set1_epi16(int16_t(0x80FF));
+    const __m128i zero = _mm_setzero_si128();
+
+    for ( ; end - p >= 32; p += 32, q += 16)
+    {
+      const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+      const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16));
+      const __m128i bad = _mm_or_si128(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(bad, zero)) != 0xFFFF) break;
+
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(q), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+    }
+  }
+
+#else
+
+  inline void widenASCII(const unsigned char * &, const unsigned char *, unsigned char * &) { }
+  inline void narrowASCII(const unsigned char * &, const unsigned char *, char * &) { }
+
+#endif
+}
+
+size_t appendUTF16BEFromUTF8(std::string & out, const char * str, size_t len)
+{
+  // Each input byte gives at most two output bytes (four-byte sequences become surrogate pairs).
+  const size_t start = out.size();
+  out.resize(start + 2 * len);
+
+  const unsigned char * s = reinterpret_cast<const unsigned char *>(str), * const end = s + len;
+  unsigned char * const begin = reinterpret_cast<unsigned char *>(&out[0]) + start;
+  unsigned char * q = begin;
+
+  while (s != end)
+  {
+    widenASCII(s, end, q);
+
+    // The rest of the block the vector loop stopped at, up to its first non-ASCII byte.
+    while (s != end && *s < 0x80) q = putUnit(q, *s++);
+
+    if (s != end) q = putSequence(s, end, q);
+  }
+
+  out.resize(start + (q - begin));
+  return (q - begin) / 2;
+}
+
+void appendUTF8FromUTF16BE(std::string & out, const unsigned char * p, size_t n)
+{
+  // Each code unit gives at most three bytes (a surrogate pair gives four).
+  const size_t start = out.size();
+  out.resize(start + 3 * n);
+
+  const unsigned char * const end = p + 2 * n;
+  char * const begin = &out[0] + start;
+  char * q = begin;
+
+  while (p != end)
+  {
+    narrowASCII(p, end, q);
+
+    while (p != end && getUnit(p) < 0x80) { *q++ = char(p[1]); p += 2; }
+
+    if (p == end) break;
+
+    uint32_t cp = getUnit(p);
+    p += 2;
+
+    if (cp >= 0xD800 && cp <= 0xDBFF && p != end && getUnit(p) >= 0xDC00 && getUnit(p) <= 0xDFFF)
+    {
+      cp = 0x10000 + ((cp - 0xD800) << 10) + (getUnit(p) - 0xDC00);
+      p += 2;
+    }
+    else if (cp >= 0xD800 && cp <= 0xDFFF)
+    {
+      cp = REPLACEMENT_CHARACTER;
+    }
+
+    q = putUTF8(q, cp);
+  }
+
+  out.resize(start + (q - begin));
+}
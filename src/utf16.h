@@ -0,0 +1,27 @@
+#ifndef H_UTF16
+#define H_UTF16
+
+
+#include <string>
+#include <cstddef>
+
+/* Transcoding between UTF-8, which we use internally, and UTF-16BE, which the
+ * protocol uses for strings (prefixed by their length in 16-bit code units).
+ *
+ * Both directions validate their input and replace anything malformed by U+FFFD:
+ * stray, truncated and overlong UTF-8 sequences, encoded surrogates and unpaired
+ * UTF-16 surrogates. Characters outside the BMP become surrogate pairs and back.
+ *
+ * Runs of ASCII, i.e. almost all chat and sign text, are converted sixteen
+ * characters at a time with SSE2 if the compiler targets it; everything else
+ * goes through the scalar code, which gives the same results.
+ */
+
+/// Appends the UTF-16BE form of len bytes of UTF-8 to out; returns the number of code units appended.
+size_t appendUTF16BEFromUTF8(std::string & out, const char * s, size_t len);
+
+/// Appends the UTF-8 form of n UTF-16BE code units (2n bytes) to out.
+void appendUTF8FromUTF16BE(std::string & out, const unsigned char * p, size_t n);
+
+
+#endif